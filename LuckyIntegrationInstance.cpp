@@ -5,7 +5,6 @@
 #include <pcl/FileFormatInstance.h>
 #include <pcl/MuteStatus.h>
 #include <pcl/Mutex.h>
-#include <pcl/MultiscaleMedianTransform.h>
 #include <pcl/ProcessInterface.h>
 #include <pcl/StandardStatus.h>
 #include <pcl/View.h>
@@ -13,6 +12,8 @@
 
 #include "LuckyIntegrationInstance.h"
 #include "LuckyIntegrationParameters.h"
+#include "NativeImageAnalysis.h"
+#include "NativeImagePSF.h"
 
 namespace pcl
 {
@@ -41,12 +42,58 @@ static bool LoadImage(Image& image, const String& filePath)
     return true;
 }
 
+// Width and height of the first image of a file, without reading its pixels
+static void GetImageSize(const String& filePath, int& width, int& height)
+{
+    if (!File::Exists(filePath))
+        throw Error(filePath + ": not found.");
+
+    FileFormat format(File::ExtractExtension(filePath), true/*toRead*/, false/*toWrite*/);
+    FileFormatInstance file(format);
+
+    ImageDescriptionArray images;
+
+    if (!file.Open(images, filePath))
+        throw CaughtException();
+    if (images.IsEmpty())
+        throw Error(filePath + ": Empty image file.");
+    width = images[0].info.width;
+    height = images[0].info.height;
+    if (!file.Close())
+        throw CaughtException();
+}
+
+// The *.fit and *.fits files of the input directory, sorted by name
+static StringList FindInputFiles(const String& inputPath)
+{
+    StringList filenames;
+    File::Find find;
+    FindFileInfo info;
+    find.Begin(inputPath + "\\*.fit");
+    while (find.NextItem(info))
+    {
+        filenames.Add(inputPath + "\\" + info.name);
+    }
+    find.End();
+    find.Begin(inputPath + "\\*.fits");
+    while (find.NextItem(info))
+    {
+        filenames.Add(inputPath + "\\" + info.name);
+    }
+    find.End();
+    if (filenames.Length() == 0)
+        throw Error("No *.fit / *.fits files in the selected directory.");
+    filenames.Sort();
+    return filenames;
+}
+
 struct ImageThreadGlobalData
 {
     StringList inputFilenames;
+    Array<int> schedule;        // frames to read, in order
     int width;
     int height;
-    AtomicInt imageIdx;
+    AtomicInt imageIdx;         // next entry of the schedule
     Mutex lock;
 };
 
@@ -59,6 +106,8 @@ protected:
     int m_id;
     static ImageThreadGlobalData m_globalData;
     LuckyIntegrationInstance* m_instance;
+    NativeImagePool m_pool;     // per-worker frame buffers
+    Image m_readImage;          // decode buffer, reused across frames
 
     ImageThread(int id, LuckyIntegrationInstance* instance)
         : m_id(id)
@@ -68,28 +117,18 @@ protected:
         if (m_id != 0)
             return;
 
-        m_globalData.inputFilenames.Clear();
+        m_globalData.inputFilenames = FindInputFiles(m_instance->p_inputPath);
         m_globalData.width = 0;
         m_globalData.height = 0;
         m_globalData.imageIdx = 0;
 
-        File::Find find;
-        FindFileInfo info;
-        find.Begin(m_instance->p_inputPath + "\\*.fit");
-        while (find.NextItem(info))
-        {
-            m_globalData.inputFilenames.Add(m_instance->p_inputPath + "\\" + info.name);
-        }
-        find.End();
-        find.Begin(m_instance->p_inputPath + "\\*.fits");
-        while (find.NextItem(info))
-        {
-            m_globalData.inputFilenames.Add(m_instance->p_inputPath + "\\" + info.name);
-        }
-        find.End();
-        if (m_globalData.inputFilenames.Length() == 0)
-            throw Error("No *.fit / *.fits files in the selected directory.");
-        m_globalData.inputFilenames.Sort();
+        // Every frame is aligned; the frame percentage selects among them at integration
+        int numFrames = int(m_globalData.inputFilenames.Length());
+        if (m_instance->p_routine == LIRoutine::StarDetectionPreview)
+            numFrames = 1;
+        m_globalData.schedule.Clear();
+        for (int i = 0; i < numFrames; i++)
+            m_globalData.schedule.Append(i);
     }
 
     virtual ~ImageThread()
@@ -104,11 +143,11 @@ protected:
                 Console console;
                 if (console.AbortRequested())
                     throw ProcessAborted();
-                NativeImage srcImage;
+                NativeImage srcImage(&m_pool);
                 int imageIdx;
                 if (!read(srcImage, imageIdx))
                     break;
-                NativeImage dstImage;
+                NativeImage dstImage(&m_pool);
                 process(dstImage, srcImage, imageIdx);
              }
         }
@@ -139,19 +178,20 @@ protected:
         bool done = false;
 
         m_globalData.lock.Lock();
-        imageIdx = m_globalData.imageIdx.Load();
-        if (imageIdx >= int(m_globalData.inputFilenames.Length() * (m_instance->p_framePercentage * 0.01)))
+        int next = m_globalData.imageIdx.Load();
+        if (next >= int(m_globalData.schedule.Length()))
             done = true;
-        else if ((m_instance->p_routine == LIRoutine::StarDetectionPreview) && (imageIdx >= 1))
-            done = true;
-        if (!done)
+        else
+        {
+            imageIdx = m_globalData.schedule[next];
             m_globalData.imageIdx.Increment();
+        }
         m_globalData.lock.Unlock();
 
         if (done)
             return false;
 
-        Image image;
+        Image& image = m_readImage;
         LoadImage(image, m_globalData.inputFilenames[imageIdx]);
         m_globalData.lock.Lock();
         if (m_globalData.width == 0)
@@ -189,7 +229,7 @@ public:
         {
             ProcessInterface::ProcessEvents();
             pcl::Sleep(100);
-            Console().Write(String().Format("<clreol>%d / %d source images processed.", m_globalData.imageIdx.Load(), m_globalData.inputFilenames.Length()) + "<bol>");
+            Console().Write(String().Format("<clreol>%d / %d source images processed.", m_globalData.imageIdx.Load(), m_globalData.schedule.Length()) + "<bol>");
             bool completed = true;
             for (T& t : threads)
             {
@@ -201,6 +241,13 @@ public:
                 break;
         }
         Console().WriteLn("Done.<clreol>");
+        size_t numAllocations = 0, numReuses = 0;
+        for (T& t : threads)
+        {
+            numAllocations += t.m_pool.numAllocations();
+            numReuses += t.m_pool.numReuses();
+        }
+        Console().WriteLn(String().Format("Frame buffers: %u allocated, %u allocations avoided by reuse.", unsigned(numAllocations), unsigned(numReuses)));
         String err = "";
         for (T& t : threads)
             if (t.m_threadErrorMsg != "")
@@ -216,251 +263,312 @@ public:
 
 ImageThreadGlobalData ImageThread::m_globalData;
 
+// Runs one row band of a single-frame pass. Used to spread the detection on
+// the reference frame, which no other worker can help with, over all cores.
+template<class F>
+class BandThread : public Thread
+{
+private:
+    const F& m_f;
+    int m_band;
+    String m_threadErrorMsg;
+
+    BandThread(const F& f, int band)
+        : m_f(f)
+        , m_band(band)
+    {
+    }
+
+    void Run() override
+    {
+        try {
+            m_f(m_band);
+        }
+        catch (Exception& x) {
+            m_threadErrorMsg = x.Message();
+        }
+        catch (std::bad_alloc&) {
+            m_threadErrorMsg = "Out of memory";
+        }
+        catch (...) {
+            m_threadErrorMsg = "Unknown error";
+        }
+    }
+
+public:
+    // Calls f(band) for bands 0 .. numBands-1 concurrently and waits for all
+    static void run(int numBands, const F& f)
+    {
+        if (numBands <= 1)
+        {
+            f(0);
+            return;
+        }
+        ReferenceArray<BandThread> threads;
+        for (int i = 0; i < numBands; i++)
+        {
+            BandThread* thread = new BandThread(f, i);
+            threads << thread;
+            thread->Start(ThreadPriority::DefaultMax, i);
+        }
+        for (BandThread& t : threads)
+            t.Wait();
+        String err = "";
+        for (BandThread& t : threads)
+            if (t.m_threadErrorMsg != "")
+            {
+                err = t.m_threadErrorMsg;
+                break;
+            }
+        threads.Destroy();
+        if (err != "")
+            throw Error(err);
+    }
+};
+
+template<class F>
+static void runBands(int numBands, const F& f)
+{
+    BandThread<F>::run(numBands, f);
+}
+
+// Row of the star table as the per-frame star list used while tracking
+static void getStars(Array<Star>& stars, const NativeStarTable& table, int frame)
+{
+    stars.Clear();
+    for (int i = 0; i < table.numStars(); i++)
+    {
+        Star s;
+        s.id = i;
+        s.x = table.row(frame, NativeStarTable::X)[i];
+        s.y = table.row(frame, NativeStarTable::Y)[i];
+        s.background = table.row(frame, NativeStarTable::Background)[i];
+        s.peak = table.row(frame, NativeStarTable::Peak)[i];
+        s.sizeX = table.row(frame, NativeStarTable::SizeX)[i];
+        s.sizeY = table.row(frame, NativeStarTable::SizeY)[i];
+        s.fwhm = table.row(frame, NativeStarTable::Fwhm)[i];
+        s.ellipticity = table.row(frame, NativeStarTable::Ellipticity)[i];
+        s.angle = table.row(frame, NativeStarTable::Angle)[i];
+        s.flux = table.row(frame, NativeStarTable::Flux)[i];
+        stars.Append(s);
+    }
+}
+
+// Stores a star list as a row of the star table, growing the table as needed.
+// Stars with a zero peak were not measured in this frame.
+static void setStars(NativeStarTable& table, int frame, const Array<Star>& stars)
+{
+    table.resize(frame + 1);
+    for (int i = 0; i < table.numStars(); i++)
+    {
+        const Star& s = stars[i];
+        table.row(frame, NativeStarTable::X)[i] = s.x;
+        table.row(frame, NativeStarTable::Y)[i] = s.y;
+        table.row(frame, NativeStarTable::Background)[i] = s.background;
+        table.row(frame, NativeStarTable::Peak)[i] = s.peak;
+        table.row(frame, NativeStarTable::SizeX)[i] = s.sizeX;
+        table.row(frame, NativeStarTable::SizeY)[i] = s.sizeY;
+        table.row(frame, NativeStarTable::Fwhm)[i] = s.fwhm;
+        table.row(frame, NativeStarTable::Ellipticity)[i] = s.ellipticity;
+        table.row(frame, NativeStarTable::Angle)[i] = s.angle;
+        table.row(frame, NativeStarTable::Flux)[i] = s.flux;
+        table.setValid(frame, i, s.peak != 0.0f);
+    }
+    table.setStored(frame);
+}
+
 class StarDetectionThread : public ImageThread
 {
+    Array<NativeIntegralImage> m_bandIntegrals;
+    NativeComponentLabeling m_labeling;
+    NativePointGrid m_detectionGrid;
+    NativePSFFitter m_psf;
+    Array<int> m_psfIndex;
+
+    // Row bands for single-frame passes, at least 64 rows each
+    static int numBands(int height)
+    {
+        return Max(1, Min(Thread::NumberOfThreads(PCL_MAX_PROCESSORS, 1), height / 64));
+    }
+
+    static int bandBegin(int band, int numBands, int height)
+    {
+        return int(int64(height) * band / numBands);
+    }
+
     void cosmeticCorrection(NativeImage& dstImg, const NativeImage& srcImg, bool invalidate)
     {
-        const int half_box_size = 1;
-        int w = srcImg.width();
         int h = srcImg.height();
-        dstImg.allocate<float>(w, h);
-        // Calculate 3x3 mean
-        for (int y = 0; y < h; y++)
+        int bands = numBands(h);
+        dstImg.allocate<float>(srcImg.width(), h);
+        auto dst = dstImg.view<float>();
+        auto src = srcImg.view<float>();
+        runBands(bands, [&](int band)
         {
-            for (int x = 0; x < w; x++)
-            {
-                // Calculate mean
-                float sum = 0.0f;
-                int n = 0;
-                for (int dy = y - half_box_size; dy <= y + half_box_size; dy++)
-                {
-                    if ((dy < 0) || (dy >= h))
-                        continue;
-                    for (int dx = x - half_box_size; dx <= x + half_box_size; dx++)
-                    {
-                        if ((dx < 0) || (dx >= w))
-                            continue;
-                        sum += srcImg.get(dx, dy);
-                        n++;
-                    }
-                }
-                float mean = sum / n;
-                // Calculate variance
-                sum = 0.0f;
-                n = 0;
-                for (int dy = y - half_box_size; dy <= y + half_box_size; dy++)
-                {
-                    if ((dy < 0) || (dy >= h))
-                        continue;
-                    for (int dx = x - half_box_size; dx <= x + half_box_size; dx++)
-                    {
-                        if ((dx < 0) || (dx >= w))
-                            continue;
-                        float d = srcImg.get(dx, dy) - mean;
-                        sum += d * d;
-                        n++;
-                    }
-                }
-                float var = sum / n;
-                // Correction
-                float v = srcImg.get(x, y);
-                float d = v - mean;
-                if (d * d > 4.0f * var)    // 2 sigma
-                {
-                    if (invalidate)
-                    {
-                        dstImg.set(nanf(""), x, y);
-                    }
-                    else
-                    {
-                        Array<float> vals;
-                        int n = 0;
-                        for (int dy = y - half_box_size; dy <= y + half_box_size; dy++)
-                        {
-                            if ((dy < 0) || (dy >= h))
-                                continue;
-                            for (int dx = x - half_box_size; dx <= x + half_box_size; dx++)
-                            {
-                                if ((dx < 0) || (dx >= w))
-                                    continue;
-                                vals.Append(srcImg.get(dx, dy));
-                                n++;
-                            }
-                        }
-                        vals.Sort();
-                        dstImg.set(vals[n / 2], x, y);
-                    }
-                }
-                else
-                {
-                    dstImg.set(v, x, y);
-                }
-            }
-        }
+            NativeCosmeticCorrection::apply(dst, src, invalidate, bandBegin(band, bands, h), bandBegin(band + 1, bands, h));
+        });
     }
 
-    void getBackground(NativeImage& dstImg, const NativeImage& srcImg)
+    // Cells of 64 pixels match the largest scale removed by the 6-layer
+    // multiscale median this model replaces
+    static constexpr int BackgroundCellSize = 64;
+
+    void getBackground(NativeBackgroundMesh& background, const NativeImage& srcImg)
     {
-        // Extract background
-        ImageVariant medImg;
-        medImg.CreateFloatImage();
-        medImg.AllocateData(srcImg.width(), srcImg.height());
-        CopyMemory(static_cast<Image&>(*medImg).PixelData(), srcImg.data(), srcImg.size());
-        medImg.SetStatusCallback(nullptr);
-        MultiscaleMedianTransform mmt(6);
-        mmt << medImg;
-        mmt.DisableLayer(0);
-        mmt.DisableLayer(1);
-        mmt.DisableLayer(2);
-        mmt.DisableLayer(3);
-        mmt.DisableLayer(4);
-        mmt.DisableLayer(5);
-        mmt >> medImg;
-        medImg.Truncate(0.0f, 1.0f);
-        dstImg.allocate<float>(srcImg.width(), srcImg.height());
-        CopyMemory(dstImg.data(), static_cast<Image&>(*medImg).PixelData(), dstImg.size());
+        auto src = srcImg.view<float>();
+        background.begin(srcImg.width(), srcImg.height(), BackgroundCellSize);
+        int rows = background.cellsY();
+        int bands = Max(1, Min(Thread::NumberOfThreads(PCL_MAX_PROCESSORS, 1), rows));
+        runBands(bands, [&](int band)
+        {
+            background.measure(src, bandBegin(band, bands, rows), bandBegin(band + 1, bands, rows));
+        });
+        background.finish();
+    }
+
+    float backgroundAt(float x, float y) const
+    {
+        return Range(m_instance->m_background.get(x, y), 0.0f, 1.0f);
+    }
+
+    NativeGaussianProfile calcProfile(const Array<float>& v)
+    {
+        NativeGaussianProfile g = NativeGaussianFit::fit(v.Begin(), int(v.Length()));
+        g.sigma = Range(g.sigma, 0.1f, 20.0f);
+        return g;
     }
 
-    float calcFwhm(const Array<float>& v)
+    // Measures the PSF of every star that is still alive. A star whose 2D fit
+    // fails is dropped from the frame.
+    void measureStars(Array<Star>& stars, const NativeImageView<const float>& src, int range)
     {
-        int b = int(v.Length() / 2);
-        float a = v[b];
-        float best_c = 0.0f, min_e = 1.0e+6;
-        for (float c = 0.1f; c < 20.0f; c += 0.1f)
+        if (m_instance->p_psfModel == LIPSFModel::Separable)
         {
-            float e = 0.0f;
-            for (int x = 0; x <= 2 * b; x++)
+            Array<float> x_values(range * 2 + 1), y_values(range * 2 + 1);
+            for (auto& s : stars)
+            {
+                if (s.peak == 0.0f)
+                    continue;
+                for (int i = -range; i <= range; i++)
+                {
+                    x_values[i + range] = src.getBilinear(s.x + i, s.y) - s.background;
+                    y_values[i + range] = src.getBilinear(s.x, s.y + i) - s.background;
+                }
+                NativeGaussianProfile gx = calcProfile(x_values);
+                NativeGaussianProfile gy = calcProfile(y_values);
+                s.sizeX = gx.fwhm();
+                s.sizeY = gy.fwhm();
+                s.fwhm = 0.5f * (s.sizeX + s.sizeY);
+                s.ellipticity = 1.0f - Min(s.sizeX, s.sizeY) / Max(s.sizeX, s.sizeY);
+                s.angle = (s.sizeX >= s.sizeY) ? 0.0f : 90.0f;
+                s.flux = Const<float>::pi() * (gx.amplitude + gy.amplitude) * gx.sigma * gy.sigma;
+            }
+            return;
+        }
+
+        m_psfIndex.Clear();
+        m_psf.begin(range, int(stars.Length()));
+        for (int i = 0; i < stars.Length(); i++)
+            if (stars[i].peak != 0.0f)
             {
-                float g = a * Exp(-(x - b) * (x - b) / (2 * c * c));
-                g -= v[x];
-                e += g * g;
+                m_psf.add(src, stars[i].x, stars[i].y, stars[i].background, stars[i].peak, m_instance->p_approxFwhm);
+                m_psfIndex.Append(i);
             }
-            if (e < min_e)
+        m_psf.fit();
+        for (int k = 0; k < m_psfIndex.Length(); k++)
+        {
+            Star& s = stars[m_psfIndex[k]];
+            NativePSF psf = m_psf.result(k);
+            if (!psf.valid)
             {
-                min_e = e;
-                best_c = c;
+                s.peak = 0.0f;
+                continue;
             }
+            s.sizeX = psf.fwhmX;
+            s.sizeY = psf.fwhmY;
+            s.fwhm = psf.fwhm;
+            s.ellipticity = psf.ellipticity;
+            s.angle = psf.angle;
+            s.flux = psf.flux;
         }
-        return best_c * 2.35482f;
     }
 
     void starDetection(Array<Star>& stars, NativeImage& dstImg, const NativeImage& srcImg)
     {
-        NativeImage tmpImg;
+        NativeImage tmpImg(&m_pool);
         int w = srcImg.width();
         int h = srcImg.height();
         tmpImg.allocate<float>(w, h);
+        auto src = srcImg.view<float>();
+        auto tmp = tmpImg.view<float>();
         int half_box_size = int(m_instance->p_approxFwhm + 0.5);
-        int step = (half_box_size * 2 + 1) / 7;
-        if (step < 1)
-            step = 1;
-
-        // Calculate box mean
-        for (int y = 0; y < h; y++)
+        int bands = numBands(h);
+        const NativeKernels& kernels = NativeKernels::get();
+
+        // Calculate box mean and subtract it. Each band gets its own summed-area
+        // tables over the band plus half_box_size rows of halo on both sides.
+        if (m_bandIntegrals.Length() < size_t(bands))
+            m_bandIntegrals.Resize(bands);
+        runBands(bands, [&](int band)
         {
-            for (int x = 0; x < w; x++)
-            {
-                float sum = 0.0f;
-                int n = 0;
-                for (int dy = y - half_box_size; dy <= y + half_box_size; dy += step)
-                {
-                    if ((dy < 0) || (dy >= h))
-                        continue;
-                    for (int dx = x - half_box_size; dx <= x + half_box_size; dx += step)
-                    {
-                        if ((dx < 0) || (dx >= w))
-                            continue;
-                        float v = srcImg.get(dx, dy);
-                        if (isnan(v))
-                            continue;
-                        sum += v;
-                        n++;
-                    }
-                }
-                tmpImg.set(sum / n, x, y);
-            }
-        }
-
-        // Substract
-        tmpImg.rsub(srcImg);
+            int y0 = bandBegin(band, bands, h);
+            int y1 = bandBegin(band + 1, bands, h);
+            int h0 = Max(0, y0 - half_box_size);
+            int h1 = Min(h, y1 + half_box_size);
+            NativeIntegralImage& integral = m_bandIntegrals[band];
+            integral.build({ src.row(h0), w, h1 - h0, src.pitch });
+            integral.boxMean({ tmp.row(h0), w, h1 - h0, tmp.pitch }, half_box_size, y0 - h0, y1 - h0);
+            for (int y = y0; y < y1; y++)
+                kernels.rsub(tmp.row(y), src.row(y), w);
+        });
 
         // Binarize + 5x5 median
-        NativeImage binImg;
-        binImg.allocate<float>(w, h);
-        for (int y = 0; y < h; y++)
-            for (int x = 0; x < w; x++)
-            {
-                int n = 0;
-                for (int dy = y - 2; dy <= y + 2; dy++)
+        NativeImage binImg(&m_pool);
+        binImg.allocate<uint8_t>(w, h);
+        auto bin = binImg.view<uint8_t>();
+        float minPeak = m_instance->p_minPeak;
+        runBands(bands, [&](int band)
+        {
+            for (int y = bandBegin(band, bands, h); y < bandBegin(band + 1, bands, h); y++)
+                for (int x = 0; x < w; x++)
                 {
-                    if ((dy < 0) || (dy >= h))
-                        continue;
-                    for (int dx = x - 2; dx <= x + 2; dx++)
+                    int n = 0;
+                    for (int dy = y - 2; dy <= y + 2; dy++)
                     {
-                        if ((dx < 0) || (dx >= w))
+                        if ((dy < 0) || (dy >= h))
                             continue;
-                        float v = tmpImg.get(dx, dy);
-                        if (isnan(v))
-                            continue;
-                        if (v >= m_instance->p_minPeak)
-                            n++;
+                        for (int dx = x - 2; dx <= x + 2; dx++)
+                        {
+                            if ((dx < 0) || (dx >= w))
+                                continue;
+                            float v = tmp(dx, dy);
+                            if (isnan(v))
+                                continue;
+                            if (v >= minPeak)
+                                n++;
+                        }
                     }
+                    bin(x, y) = (n >= 5) ? 1 : 0;
                 }
-                if (n >= 5)
-                    binImg.set(1.0f, x, y);
-                else
-                    binImg.set(0.0f, x, y);
-            }
+        });
 
-        // Get connected components
+        // Get connected components, merged across band seams
         Array<Star> detections;
         detections.Clear();
-        Array<Array<Point>> components;
-        for (int y = 0; y < h; y++)
-            for (int x = 0; x < w; x++)
-            {
-                Array<Point> points;
-                Array<Point> stack;
-                if (binImg.get(x, y) == 0.0f)
-                    continue;
-                points.Append(Point(x, y));
-                binImg.set(0.0f, x, y);
-                stack.Append(Point(x, y));
-                while (stack.Length() > 0)
-                {
-                    Point p = *(stack.ReverseBegin());
-                    stack.Remove(stack.ReverseBegin());
-                    const int neighbor_x[] = {-1, 0, 1, -1, 1, -1, 0, 1};
-                    const int neighbor_y[] = {-1, -1, -1, 0, 0, 1, 1, 1};
-                    for (int i = 0; i < 8; i++)
-                    {
-                        int dx = p.x + neighbor_x[i];
-                        int dy = p.y + neighbor_y[i];
-                        if ((dx < 0) || (dx >= w) || (dy < 0) || (dy >= h))
-                            continue;
-                        if (binImg.get(dx, dy) > 0.0f)
-                        {
-                            points.Append(Point(dx, dy));
-                            binImg.set(0.0f, dx, dy);
-                            stack.Append(Point(dx, dy));
-                        }
-                    }
-                }
-                components.Append(points);
-            }
+        m_labeling.begin(static_cast<const NativeImage&>(binImg).view<uint8_t>(), bands);
+        runBands(bands, [&](int band)
+        {
+            m_labeling.labelBand(band);
+        });
+        const auto& components = m_labeling.finish();
 
         // Components -> stars
         int n_stars = 0;
-        for (const auto& points : components)
+        for (const auto& c : components)
         {
             Star s{};
-            for (int i = 0; i < points.Length(); i++)
-            {
-                s.x += points[i].x;
-                s.y += points[i].y;
-            }
-            s.x = s.x / points.Length() + 0.5f;
-            s.y = s.y / points.Length() + 0.5f;
+            s.x = float(c.sumX / c.count) + 0.5f;
+            s.y = float(c.sumY / c.count) + 0.5f;
             int range = m_instance->p_approxFwhm * 2.0f + 0.5f;
             if ((s.x < range) || (s.x >= w - range) || (s.y < range) || (s.y >= h - range))
                 continue;
@@ -468,39 +576,36 @@ class StarDetectionThread : public ImageThread
             float peak = 0.0f;
             float mass = 0.0f;
             float center_x = 0.0f, center_y = 0.0f;
+            float background = backgroundAt(s.x, s.y);
             for (int y = s.y - range; y <= s.y + range; y++)
                 for (int x = s.x - range; x <= s.x + range; x++)
                 {
-                    float v = srcImg.get(x, y);
+                    float v = src(x, y);
                     if (isnan(v))
                         continue;
                     if (v > peak)
                         peak = v;
-                    v -= m_instance->m_backgroundImage.getBilinear(s.x, s.y);;
+                    v -= background;
                     mass += v;
                     center_x += x * v;
                     center_y += y * v;
                 }
             s.x = center_x / mass;
             s.y = center_y / mass;
-            s.background = m_instance->m_backgroundImage.getBilinear(s.x, s.y);
+            s.background = backgroundAt(s.x, s.y);
             s.peak = peak;
             if ((s.x < range) || (s.x >= w - range) || (s.y < range) || (s.y >= h - range))
                 continue;
-            // Calculate size
-            Array<float> x_values(range * 2 + 1), y_values(range * 2 + 1);
-            for (int i = -range; i <= range; i++)
-            {
-                x_values[i + range] = srcImg.getBilinear(s.x + i, s.y) - s.background;
-                y_values[i + range] = srcImg.getBilinear(s.x, s.y + i) - s.background;
-            }
-            s.sizeX = calcFwhm(x_values);
-            s.sizeY = calcFwhm(y_values);
             s.id = n_stars++;
             detections.Append(s);
         }
 
+        // Size
+        measureStars(detections, src, int(m_instance->p_approxFwhm * 2.0f + 0.5f));
+
         // Filtering
+        float minDistance = m_instance->p_approxFwhm * 4.0f;
+        m_detectionGrid.build(detections, minDistance);
         for (auto& s : detections)
         {
             if (s.peak == 0.0f)
@@ -517,16 +622,14 @@ class StarDetectionThread : public ImageThread
             if (s.sizeY < m_instance->p_approxFwhm * 0.5f)
                 s.peak = 0.0f;
             // distance
-            for (const auto& s1 : detections)
+            bool crowded = false;
+            m_detectionGrid.forEachWithin(s.x, s.y, minDistance, [&](int i)
             {
-                if (s.id == s1.id)
-                    continue;
-                if ((s.x - s1.x) * (s.x - s1.x) + (s.y - s1.y) * (s.y - s1.y) < m_instance->p_approxFwhm * m_instance->p_approxFwhm * 16.0f)
-                {
-                    s.peak = 0.0f;
-                    break;
-                }
-            }
+                if (detections[i].id != s.id)
+                    crowded = true;
+            });
+            if (crowded)
+                s.peak = 0.0f;
         }
 
         // Output
@@ -563,7 +666,78 @@ class StarDetectionThread : public ImageThread
         }
     }
 
-    void starMovement(Array<Star>& stars, NativeImage& dstImg, const Array<Star>& prevStars, const NativeImage& srcImg)
+    // Background-subtracted centre of mass and peak in the (2 range + 1)^2
+    // window around (x, y). Fails when the window leaves the frame or holds no
+    // signal above the background.
+    static bool centroid(const NativeImageView<const float>& src, float& x, float& y, float& peak, float background, int range)
+    {
+        if ((x < range) || (x >= src.width - range) || (y < range) || (y >= src.height - range))
+            return false;
+        float mass = 0.0f;
+        float center_x = 0.0f, center_y = 0.0f;
+        peak = 0.0f;
+        for (int iy = y - range; iy <= y + range; iy++)
+            for (int ix = x - range; ix <= x + range; ix++)
+            {
+                float v = src(ix, iy);
+                if (isnan(v))
+                    continue;
+                if (v > peak)
+                    peak = v;
+                v -= background;
+                mass += v;
+                center_x += ix * v;
+                center_y += iy * v;
+            }
+        if (mass <= 0.0f)
+            return false;
+        x = center_x / mass;
+        y = center_y / mass;
+        return true;
+    }
+
+    // Shift of the frame against the reference, from the brightest reference
+    // stars re-centred in windows shrinking from four times the tracking
+    // window. Each frame is handled on its own, so frames can be tracked in
+    // parallel even when the drift exceeds the tracking window.
+    F32Point estimateShift(const Array<Star>& refStars, const NativeImageView<const float>& src, int range)
+    {
+        const int numProbes = 8;
+        Array<int> order;
+        for (int i = 0; i < refStars.Length(); i++)
+            if (refStars[i].peak != 0.0f)
+                order.Append(i);
+        std::sort(order.Begin(), order.End(), [&](int a, int b) { return refStars[a].peak > refStars[b].peak; });
+        std::vector<float> dx, dy;
+        for (int k = 0; (k < order.Length()) && (int(dx.size()) < numProbes); k++)
+        {
+            const Star& s = refStars[order[k]];
+            float x = s.x, y = s.y, peak;
+            bool found = true;
+            for (int r = range * 4; found && (r >= range); r /= 2)
+                found = centroid(src, x, y, peak, s.background, r);
+            if (found)
+            {
+                dx.push_back(x - s.x);
+                dy.push_back(y - s.y);
+            }
+        }
+        if (dx.empty())
+            return F32Point(0.0f, 0.0f);
+        std::nth_element(dx.begin(), dx.begin() + dx.size() / 2, dx.end());
+        std::nth_element(dy.begin(), dy.begin() + dy.size() / 2, dy.end());
+        return F32Point(dx[dx.size() / 2], dy[dy.size() / 2]);
+    }
+
+    // Half size of the centroid window used for tracking
+    int trackingRange() const
+    {
+        return Max(1, int(m_instance->p_approxFwhm * m_instance->p_trackingWindow + 0.5));
+    }
+
+    // Re-centres each of prevStars, offset by `shift`, in the frame. Lost
+    // stars are carried forward unchanged; only recoverStars() revives them.
+    void starMovement(Array<Star>& stars, NativeImage& dstImg, const Array<Star>& prevStars, const NativeImage& srcImg, F32Point shift = F32Point(0.0f, 0.0f))
     {
         int w = srcImg.width();
         int h = srcImg.height();
@@ -574,61 +748,125 @@ class StarDetectionThread : public ImageThread
             dstImg.zero();
         }
         m_globalData.lock.Unlock();
-        int range = m_instance->p_approxFwhm * 2.0f + 0.5f;
+        auto src = srcImg.view<float>();
+        int range = trackingRange();
         for (const auto& s : prevStars)
         {
             Star star = s;
-            // Recalculate mass center
-            if ((s.x < range) || (s.x >= w - range) || (s.y < range) || (s.y >= h - range))
+            if (s.peak == 0.0f)
             {
-                star.peak = 0.0f;
                 stars.Append(star);
                 continue;
             }
-            // Calculate mass center and peak
-            float peak = 0.0f;
-            float mass = 0.0f;
-            float center_x = 0.0f, center_y = 0.0f;
-            for (int y = s.y - range; y <= s.y + range; y++)
-                for (int x = s.x - range; x <= s.x + range; x++)
-                {
-                    float v = srcImg.get(x, y);
-                    if (v > peak)
-                        peak = v;
-                    v -= s.background;
-                    mass += v;
-                    center_x += x * v;
-                    center_y += y * v;
-                }
-            star.x = center_x / mass;
-            star.y = center_y / mass;
-            star.background = s.background;
-            star.peak = peak;
-            if ((s.x < range) || (s.x >= w - range) || (s.y < range) || (s.y >= h - range))
+            star.x += shift.x;
+            star.y += shift.y;
+            if (!centroid(src, star.x, star.y, star.peak, s.background, range) ||
+                (star.x < range) || (star.x >= w - range) || (star.y < range) || (star.y >= h - range))
             {
                 star.peak = 0.0f;
                 stars.Append(star);
                 continue;
             }
-            // Calculate size
-            Array<float> x_values(range * 2 + 1), y_values(range * 2 + 1);
-            for (int i = -range; i <= range; i++)
-            {
-                x_values[i + range] = srcImg.getBilinear(star.x + i, star.y) - star.background;
-                y_values[i + range] = srcImg.getBilinear(star.x, star.y + i) - star.background;
-            }
-            star.sizeX = calcFwhm(x_values);
-            star.sizeY = calcFwhm(y_values);
             stars.Append(star);
             dstImg.set(1.0f, star.x + 0.5f, star.y + 0.5f);
         }
+        measureStars(stars, src, int(m_instance->p_approxFwhm * 2.0f + 0.5f));
+    }
+
+    // ROI-restricted re-detection. Each lost star is searched for within
+    // twice the tracking window around its expected position; the brightest
+    // pixel that passes the detection limits, away from any live star, is
+    // re-centred and revived under the star's own id. Returns the number of
+    // stars revived.
+    int recoverStars(Array<Star>& stars, const Array<Star>& stars0, const NativeImageView<const float>& src, float offsetX, float offsetY)
+    {
+        int range = trackingRange();
+        int radius = 2 * range;
+        float minSeparation = m_instance->p_approxFwhm * 2.0f;
+        Array<Star> live;
+        for (const auto& s : stars)
+            if (s.peak != 0.0f)
+                live.Append(s);
+        m_detectionGrid.build(live, minSeparation);
+
+        Array<Star> revived;
+        Array<int> revivedIdx;
+        for (int j = 0; j < stars.Length(); j++)
+        {
+            if (stars[j].peak != 0.0f)
+                continue;
+            int cx = int(stars0[j].x + offsetX + 0.5f), cy = int(stars0[j].y + offsetY + 0.5f);
+            int x0 = Max(0, cx - radius), x1 = Min(src.width - 1, cx + radius);
+            int y0 = Max(0, cy - radius), y1 = Min(src.height - 1, cy + radius);
+            float best = 0.0f;
+            int bx = -1, by = -1;
+            for (int y = y0; y <= y1; y++)
+                for (int x = x0; x <= x1; x++)
+                {
+                    float v = src(x, y);
+                    if (v > best)   // false for NaN
+                    {
+                        best = v;
+                        bx = x;
+                        by = y;
+                    }
+                }
+            if ((bx < 0) || (best < m_instance->p_minPeak) || (best > m_instance->p_saturationThreshold))
+                continue;
+            Star s = stars[j];
+            s.x = float(bx);
+            s.y = float(by);
+            if (!centroid(src, s.x, s.y, s.peak, stars0[j].background, range))
+                continue;
+            bool crowded = false;
+            m_detectionGrid.forEachWithin(s.x, s.y, minSeparation, [&](int) { crowded = true; });
+            for (const auto& r : revived)
+                if ((r.x - s.x) * (r.x - s.x) + (r.y - s.y) * (r.y - s.y) < minSeparation * minSeparation)
+                    crowded = true;
+            if (crowded)
+                continue;
+            revived.Append(s);
+            revivedIdx.Append(j);
+        }
+
+        measureStars(revived, src, int(m_instance->p_approxFwhm * 2.0f + 0.5f));
+        int count = 0;
+        for (int k = 0; k < revived.Length(); k++)
+        {
+            // Same size limit as detection, which rejects hot pixels
+            const Star& s = revived[k];
+            if ((s.peak == 0.0f) || (s.sizeX < m_instance->p_approxFwhm * 0.5f) || (s.sizeY < m_instance->p_approxFwhm * 0.5f))
+                continue;
+            stars[revivedIdx[k]] = s;
+            count++;
+        }
+        return count;
+    }
+
+    // Mean offset of the tracked stars from the reference frame
+    static bool meanOffset(const Array<Star>& stars, const Array<Star>& stars0, float& dx, float& dy)
+    {
+        double sx = 0.0, sy = 0.0;
+        int n = 0;
+        for (int i = 0; i < stars.Length(); i++)
+            if (stars[i].peak != 0.0f)
+            {
+                sx += stars[i].x - stars0[i].x;
+                sy += stars[i].y - stars0[i].y;
+                n++;
+            }
+        if (n == 0)
+            return false;
+        dx = float(sx / n);
+        dy = float(sy / n);
+        return true;
     }
 
 public:
     explicit StarDetectionThread(int id, LuckyIntegrationInstance* instance)
         : ImageThread(id, instance)
+        , m_psf((instance->p_psfModel == LIPSFModel::Moffat) ? NativePSFModel::Moffat : NativePSFModel::Gaussian)
     {
-        m_instance->m_starDetections.Clear();
     }
 
     virtual ~StarDetectionThread()
@@ -639,11 +877,11 @@ public:
     {
         if ((m_instance->p_routine == LIRoutine::StarDetectionPreview) && (imageIdx >= 1))
             return;
-        NativeImage correctedImg;
+        NativeImage correctedImg(&m_pool);
         bool corrected = false;
         if (imageIdx == 0)
         {
-            getBackground(m_instance->m_backgroundImage, srcImage);
+            getBackground(m_instance->m_background, srcImage);
             cosmeticCorrection(correctedImg, srcImage, imageIdx > 0);
             corrected = true;
         }
@@ -652,31 +890,94 @@ public:
             Array<Star> stars;
             starDetection(stars, m_instance->m_starDetectionPreviewImage, corrected ? correctedImg : srcImage);
             m_instance->m_starDetectionLock.Lock();
-            m_instance->m_starDetections.Append(stars);
+            m_instance->m_starDetections.reset(int(stars.Length()), int(m_globalData.inputFilenames.Length()));
+            setStars(m_instance->m_starDetections, 0, stars);
+            m_instance->m_trackingStates.Append(TrackingState{ NativeMotionFilter(), 0.0f, 0.0f, 0.0f, 0 });
             m_instance->m_starDetectionLock.Unlock();
         }
         else
         {
-            // Wait for previous frame
+            // Sequential tracking starts from the previous frame; independent
+            // tracking only needs the reference frame
+            bool sequential = m_instance->p_trackingMode == LITrackingMode::Sequential;
+            int prevIdx = sequential ? imageIdx - 1 : 0;
             while (1)
             {
                 m_instance->m_starDetectionLock.Lock();
-                size_t n = m_instance->m_starDetections.Length();
+                bool stored = m_instance->m_starDetections.isStored(prevIdx);
                 m_instance->m_starDetectionLock.Unlock();
-                if (imageIdx <= n)
+                if (stored)
                     break;
                 else
                     Sleep(1);
             }
             m_instance->m_starDetectionLock.Lock();
-            const Array<Star>& prevStars = m_instance->m_starDetections[size_t(imageIdx - 1)];
+            Array<Star> prevStars, stars0;
+            getStars(prevStars, m_instance->m_starDetections, prevIdx);
+            getStars(stars0, m_instance->m_starDetections, 0);
+            TrackingState state = m_instance->m_trackingStates[prevIdx];
             m_instance->m_starDetectionLock.Unlock();
+
+            // Predicted offset of this frame from the reference, and the
+            // window shift from the previous star positions that it implies
+            const NativeImage& img = corrected ? correctedImg : srcImage;
+            float predictedX = state.offsetX, predictedY = state.offsetY;
+            if (!sequential)
+            {
+                F32Point shift = estimateShift(prevStars, img.view<float>(), trackingRange());
+                predictedX = shift.x;
+                predictedY = shift.y;
+            }
+            else if (m_instance->p_motionPrediction)
+            {
+                predictedX = state.filter.offsetX() + state.filter.stepX();
+                predictedY = state.filter.offsetY() + state.filter.stepY();
+            }
+            F32Point shift(predictedX - (sequential ? state.offsetX : 0.0f), predictedY - (sequential ? state.offsetY : 0.0f));
             Array<Star> stars;
-            starMovement(stars, m_instance->m_starMovementImage, prevStars, corrected ? correctedImg : srcImage);
+            starMovement(stars, m_instance->m_starMovementImage, prevStars, img, shift);
+
+            float offsetX, offsetY;
+            if (meanOffset(stars, stars0, offsetX, offsetY))
+            {
+                if (sequential)
+                    state.filter.update(offsetX, offsetY);
+                state.residual = Sqrt((offsetX - predictedX) * (offsetX - predictedX) + (offsetY - predictedY) * (offsetY - predictedY));
+            }
+            else
+            {
+                if (sequential)
+                    state.filter.coast();
+                offsetX = predictedX;
+                offsetY = predictedY;
+                state.residual = 0.0f;
+            }
+            state.offsetX = offsetX;
+            state.offsetY = offsetY;
+
+            // Lost stars follow the field, so that later frames search for
+            // them where they are expected. Re-detection runs periodically,
+            // or as soon as too few stars are left.
+            int live = 0;
+            for (int i = 0; i < stars.Length(); i++)
+                if (stars[i].peak != 0.0f)
+                    live++;
+                else
+                {
+                    stars[i].x = stars0[i].x + offsetX;
+                    stars[i].y = stars0[i].y + offsetY;
+                }
+            int interval = int(m_instance->p_redetectionInterval);
+            bool due = (interval > 0) && (imageIdx % interval == 0);
+            bool depleted = live < m_instance->p_redetectionThreshold / 100.0 * stars.Length();
+            state.recovered = 0;
+            if ((due || depleted) && (live < stars.Length()))
+                state.recovered = recoverStars(stars, stars0, img.view<float>(), offsetX, offsetY);
             m_instance->m_starDetectionLock.Lock();
-            if (m_instance->m_starDetections.Length() < size_t(imageIdx + 1))
-                m_instance->m_starDetections.Resize(size_t(imageIdx + 1));
-            m_instance->m_starDetections[imageIdx] = stars;
+            setStars(m_instance->m_starDetections, imageIdx, stars);
+            if (m_instance->m_trackingStates.Length() < size_t(imageIdx + 1))
+                m_instance->m_trackingStates.Resize(size_t(imageIdx + 1));
+            m_instance->m_trackingStates[imageIdx] = state;
             m_instance->m_starDetectionLock.Unlock();
         }
     }
@@ -686,114 +987,116 @@ class ImageIntegrationThread : public ImageThread
 {
 private:
     NativeImage m_localIntegration;
+    NativeImageShift m_shift;
+    NativeDisplacementGrid m_aoGrid;
+    std::vector<NativeControlPoint> m_controlPoints;
+    std::vector<F32Point> m_starShifts; // displacement of every star in the current frame
     int m_numTotalImages;
     int m_numIntegratedImages;
     double m_totalTimeMs;
 
-    void integrate(const NativeImage& srcImage, int imageIdx)
+    // Rejection only depends on the frame transforms, so it is decided before
+    // any frame is read
+    bool accepts(int imageIdx) const
     {
-        const auto& stars = m_instance->m_starDetections[imageIdx];
-        const auto& stars0 = m_instance->m_starDetections[0];
-        F32Point displacement(0.0f, 0.0f);
-        float starSizeX = 0.0f, starSizeY = 0.0f;
-        for (int i = 0; i < stars.Length(); i++)
-        {
-            if (stars[i].peak == 0.0f)
-                continue;
-            displacement.x += stars[i].x - stars0[i].x;
-            displacement.y += stars[i].y - stars0[i].y;
-            starSizeX += stars[i].sizeX;
-            starSizeY += stars[i].sizeY;
-        }
-        displacement.x /= stars.Length();
-        displacement.y /= stars.Length();
-        starSizeX /= stars.Length();
-        starSizeY /= stars.Length();
-        if (Max(starSizeX, starSizeY) > m_instance->p_starSizeRejectionThreshold)    // Rejection due to star size
-            return;
-        F32Point displacementLast(0.0f, 0.0f);
-        if (imageIdx > 0)
+        const NativeFrameTable& frames = m_instance->m_frames;
+        if (!frames.isStored(imageIdx))     // Reported when processed
+            return true;
+        const NativeFrameTransform& transform = frames.transform(imageIdx);
+        if (transform.numLive <= 0)     // Nothing left to register against
+            return false;
+        if (Max(transform.sizeX, transform.sizeY) > m_instance->p_starSizeRejectionThreshold)    // Rejection due to star size
+            return false;
+        if (transform.jitter > m_instance->p_starMovementRejectionThreshold) // Rejection due to star movement
+            return false;
+        return true;
+    }
+
+    // Ranking of a frame for the frame percentage; higher is better
+    float selectionScore(int imageIdx) const
+    {
+        if (!m_instance->m_frames.isStored(imageIdx))
+            return 0.0f;
+        const NativeFrameTransform& transform = m_instance->m_frames.transform(imageIdx);
+        switch (m_instance->p_selectionMetric)
         {
-            const auto& starsLast = m_instance->m_starDetections[imageIdx - 1];
-            for (int i = 0; i < stars.Length(); i++)
-            {
-                if (stars[i].peak == 0.0f)
-                    continue;
-                displacementLast.x += stars[i].x - starsLast[i].x;
-                displacementLast.y += stars[i].y - starsLast[i].y;
-            }
-            displacementLast.x /= stars.Length();
-            displacementLast.y /= stars.Length();
+        default:
+        case LISelectionMetric::Quality:
+            return transform.quality;
+        case LISelectionMetric::StarSize:
+            return -0.5f * (transform.sizeX + transform.sizeY);
+        case LISelectionMetric::Jitter:
+            return -transform.jitter;
         }
-        if (displacementLast.DistanceToOrigin() > m_instance->p_starMovementRejectionThreshold) // Rejection due to star movement
-            return;
+    }
+
+    void integrate(const NativeImage& srcImage, int imageIdx)
+    {
+        const NativeFrameTable& frames = m_instance->m_frames;
+        const NativeFrameTransform& transform = frames.transform(imageIdx);
+        F32Point displacement(transform.shiftX, transform.shiftY);
 
         m_numIntegratedImages++;
 
         int w = srcImage.width();
         int h = srcImage.height();
-        NativeImage calibratedImage;
+        NativeImage calibratedImage(&m_pool);
         calibratedImage.allocate<float>(w, h);
-        calibratedImage.copy(srcImage);
-        if (m_instance->m_hasDark)
-        {
-            calibratedImage.sub(m_instance->m_masterDarkImage);
-            calibratedImage.addConst(m_instance->p_pedestal);
-        }
-        if (m_instance->m_hasFlat)
-        {
-            calibratedImage.div(m_instance->m_masterFlatImage);
-            calibratedImage.mulConst(m_instance->m_masterFlatMean);
-        }
-        NativeImage registeredImage;
+        calibratedImage.calibrate(srcImage,
+                                  m_instance->m_hasDark ? &m_instance->m_masterDarkImage : nullptr,
+                                  m_instance->p_pedestal,
+                                  m_instance->m_hasFlat ? &m_instance->m_masterFlatScaleImage : nullptr);
+        NativeImage registeredImage(&m_pool);
         registeredImage.allocate<float>(w, h);
+        auto calibrated = static_cast<const NativeImage&>(calibratedImage).view<float>();
+        auto registered = registeredImage.view<float>();
         if (!m_instance->p_enableDigitalAO)
         {
-            if (m_instance->p_interpolation == LIInterpolation::Nearest)
-            {
-                for (int y = 0; y < h; y++)
-                    for (int x = 0; x < w; x++)
-                        registeredImage.set(calibratedImage.getNearest(x + displacement.x, y + displacement.y), x, y);
-            }
-            else if (m_instance->p_interpolation == LIInterpolation::Bilinear)
-            {
-                for (int y = 0; y < h; y++)
-                    for (int x = 0; x < w; x++)
-                        registeredImage.set(calibratedImage.getBilinear(x + displacement.x, y + displacement.y), x, y);
-            }
-            else if (m_instance->p_interpolation == LIInterpolation::Lanczos3)
-            {
-                for (int y = 0; y < h; y++)
-                    for (int x = 0; x < w; x++)
-                        registeredImage.set(calibratedImage.getLanczos(x + displacement.x, y + displacement.y, 3), x, y);
-            }
+            m_shift.apply(registered, calibrated, displacement.x, displacement.y);
         }
         else
         {
-            for (int y = 0; y < h; y++)
-                for (int x = 0; x < w; x++)
+            const NativeLanczosLUT* lanczos = nullptr;
+            if (m_instance->p_interpolation == LIInterpolation::Lanczos3)
+                lanczos = &NativeLanczosLUT::get(3);
+            else if (m_instance->p_interpolation == LIInterpolation::Lanczos4)
+                lanczos = &NativeLanczosLUT::get(4);
+            else if (m_instance->p_interpolation == LIInterpolation::Lanczos5)
+                lanczos = &NativeLanczosLUT::get(5);
+            const NativeFrameControl* controls = frames.controls(imageIdx);
+            auto warp = [&](auto sample)
+            {
+                m_controlPoints.clear();
+                if (m_instance->p_digitalAOModel == LIDigitalAOModel::PiecewiseAffine)
+                {
+                    const NativePiecewiseAffineWarp& mesh = m_instance->m_aoMesh;
+                    if (!mesh.isRasterized(w, h))
+                        throw Error("Image dimension mismatches.");
+                    // Stars lost in this frame follow the average displacement
+                    m_starShifts.assign(frames.numStars(), displacement);
+                    for (uint32_t i = 0; i < transform.numControls; i++)
+                        m_starShifts[controls[i].star] = F32Point(controls[i].dx, controls[i].dy);
+                    for (int i : m_instance->m_aoMeshStars)
+                        m_controlPoints.push_back({ frames.referenceX(i), frames.referenceY(i), m_starShifts[i].x, m_starShifts[i].y });
+                    mesh.warp(registered, m_controlPoints, displacement.x, displacement.y, sample);
+                }
+                else
                 {
-                    F32Point displacement(0.0f, 0.0f);
-                    float w0 = 0.0f;
-                    for (int i = 0; i < stars.Length(); i++)
+                    for (uint32_t i = 0; i < transform.numControls; i++)
                     {
-                        if (stars[i].peak == 0.0f)
-                            continue;
-                        float d2 = (stars[i].x - x) * (stars[i].x - x) + (stars[i].y - y) * (stars[i].y - y);
-                        float w = 1.0f / (d2 + 1.0f);
-                        displacement.x += (stars[i].x - stars0[i].x) * w;
-                        displacement.y += (stars[i].y - stars0[i].y) * w;
-                        w0 += w;
+                        const NativeFrameControl& c = controls[i];
+                        m_controlPoints.push_back({ frames.referenceX(c.star) + c.dx, frames.referenceY(c.star) + c.dy, c.dx, c.dy });
                     }
-                    displacement.x /= w0;
-                    displacement.y /= w0;
-                    if (m_instance->p_interpolation == LIInterpolation::Nearest)
-                        registeredImage.set(calibratedImage.getNearest(x + displacement.x, y + displacement.y), x, y);
-                    else if (m_instance->p_interpolation == LIInterpolation::Bilinear)
-                        registeredImage.set(calibratedImage.getBilinear(x + displacement.x, y + displacement.y), x, y);
-                    else if (m_instance->p_interpolation == LIInterpolation::Lanczos3)
-                        registeredImage.set(calibratedImage.getLanczos(x + displacement.x, y + displacement.y, 3), x, y);
+                    m_aoGrid.build(m_controlPoints, w, h, int(m_instance->p_digitalAOGridSpacing));
+                    m_aoGrid.warp(registered, sample);
                 }
+            };
+            if (m_instance->p_interpolation == LIInterpolation::Nearest)
+                warp([&](float sx, float sy) { return calibrated.getNearest(sx, sy); });
+            else if (m_instance->p_interpolation == LIInterpolation::Bilinear)
+                warp([&](float sx, float sy) { return calibrated.getBilinear(sx, sy); });
+            else
+                warp([&](float sx, float sy) { return lanczos->interpolate(calibrated, sx, sy); });
         }
         if (m_instance->p_registrationOnly)
         {
@@ -826,10 +1129,42 @@ private:
 public:
     explicit ImageIntegrationThread(int id, LuckyIntegrationInstance* instance)
         : ImageThread(id, instance)
+        , m_shift(NativeInterpolation(instance->p_interpolation))
         , m_numTotalImages(0)
         , m_numIntegratedImages(0)
         , m_totalTimeMs(0.0)
     {
+        if (m_id != 0)
+            return;
+
+        // Rejected frames and frames outside the best percentage are counted
+        // here, by the first worker, and dropped from the schedule
+        std::vector<int> accepted;
+        for (int imageIdx : m_globalData.schedule)
+            if (accepts(imageIdx))
+                accepted.push_back(imageIdx);
+        int numRejected = int(m_globalData.schedule.Length() - accepted.size());
+        size_t numSelected = size_t(RoundInt(m_globalData.schedule.Length() * m_instance->p_framePercentage * 0.01));
+        int numDeselected = 0;
+        if (accepted.size() > numSelected)
+        {
+            // Best frames first, then back to file order to keep reads sequential
+            std::vector<float> score(m_globalData.inputFilenames.Length(), 0.0f);
+            for (int imageIdx : accepted)
+                score[imageIdx] = selectionScore(imageIdx);
+            std::stable_sort(accepted.begin(), accepted.end(), [&](int a, int b) { return score[a] > score[b]; });
+            numDeselected = int(accepted.size() - numSelected);
+            accepted.resize(numSelected);
+            std::sort(accepted.begin(), accepted.end());
+        }
+        if (numRejected > 0)
+            Console().WriteLn(String().Format("Skipping %d frames rejected by their alignment data.", numRejected));
+        if (numDeselected > 0)
+            Console().WriteLn(String().Format("Skipping %d frames outside the best %.1f%%.", numDeselected, double(m_instance->p_framePercentage)));
+        m_numTotalImages = numRejected + numDeselected;
+        m_globalData.schedule.Clear();
+        for (int imageIdx : accepted)
+            m_globalData.schedule.Append(imageIdx);
     }
 
     virtual ~ImageIntegrationThread()
@@ -854,7 +1189,7 @@ public:
 
     void process(NativeImage& dstImage, const NativeImage& srcImage, int imageIdx) override
     {
-        if (imageIdx >= m_instance->m_starDetections.Length())
+        if (!m_instance->m_frames.isStored(imageIdx))
             throw Error(String().Format("Star detection for frame #%d does not exist.", imageIdx));
 
         m_numTotalImages++;
@@ -877,12 +1212,22 @@ LuckyIntegrationInstance::LuckyIntegrationInstance(const MetaProcess* m)
     , p_approxFwhm(TheLIApproxFWHMParameter->DefaultValue())
     , p_minPeak(TheLIMinPeakParameter->DefaultValue())
     , p_saturationThreshold(TheLISaturationThresholdParameter->DefaultValue())
+    , p_psfModel(TheLIPSFModelParameter->DefaultValueIndex())
+    , p_trackingMode(TheLITrackingModeParameter->DefaultValueIndex())
+    , p_motionPrediction(TheLIMotionPredictionParameter->DefaultValue())
+    , p_trackingWindow(TheLITrackingWindowParameter->DefaultValue())
+    , p_redetectionInterval(TheLIRedetectionIntervalParameter->DefaultValue())
+    , p_redetectionThreshold(TheLIRedetectionThresholdParameter->DefaultValue())
+    , p_exportDetectionsXML(TheLIExportDetectionsXMLParameter->DefaultValue())
     , p_pedestal(TheLIPedestalParameter->DefaultValue())
     , p_enableDigitalAO(TheLIEnableDigitalAOParameter->DefaultValue())
+    , p_digitalAOModel(TheLIDigitalAOModelParameter->DefaultValueIndex())
+    , p_digitalAOGridSpacing(TheLIDigitalAOGridSpacingParameter->DefaultValue())
     , p_starSizeRejectionThreshold(TheLIStarSizeRejectionThresholdParameter->DefaultValue())
     , p_starMovementRejectionThreshold(TheLIStarMovementRejectionThresholdParameter->DefaultValue())
     , p_interpolation(TheLIInterpolationParameter->DefaultValueIndex())
     , p_framePercentage(TheLIFramePercentageParameter->DefaultValue())
+    , p_selectionMetric(TheLISelectionMetricParameter->DefaultValueIndex())
     , p_registrationOnly(TheLIRegistrationOnlyParameter->DefaultValue())
 {
 }
@@ -902,14 +1247,24 @@ void LuckyIntegrationInstance::Assign(const ProcessImplementation& p)
         p_approxFwhm = x->p_approxFwhm;
         p_minPeak = x->p_minPeak;
         p_saturationThreshold = x->p_saturationThreshold;
+        p_psfModel = x->p_psfModel;
+        p_trackingMode = x->p_trackingMode;
+        p_motionPrediction = x->p_motionPrediction;
+        p_trackingWindow = x->p_trackingWindow;
+        p_redetectionInterval = x->p_redetectionInterval;
+        p_redetectionThreshold = x->p_redetectionThreshold;
+        p_exportDetectionsXML = x->p_exportDetectionsXML;
         p_masterDark = x->p_masterDark;
         p_masterFlat = x->p_masterFlat;
         p_enableDigitalAO = x->p_enableDigitalAO;
+        p_digitalAOModel = x->p_digitalAOModel;
+        p_digitalAOGridSpacing = x->p_digitalAOGridSpacing;
         p_pedestal = x->p_pedestal;
         p_starSizeRejectionThreshold = x->p_starSizeRejectionThreshold;
         p_starMovementRejectionThreshold = x->p_starMovementRejectionThreshold;
         p_interpolation = x->p_interpolation;
         p_framePercentage = x->p_framePercentage;
+        p_selectionMetric = x->p_selectionMetric;
         p_registrationOnly = x->p_registrationOnly;
         p_registrationOutputPath = x->p_registrationOutputPath;
     }
@@ -965,6 +1320,18 @@ bool LuckyIntegrationInstance::ExecuteGlobal()
             {
                 throw Error("Registration output directory is not specified.");
             }
+
+            // Builds the interpolation tables here rather than on the first
+            // worker thread that needs them, and checks them once against
+            // the analytic filter
+            static bool lanczosChecked = false;
+            if (!lanczosChecked)
+            {
+                for (int n = 3; n <= 5; n++)
+                    if (NativeLanczosLUT::get(n).maxWeightError() > NativeLanczosLUT::MaxWeightError)
+                        throw Error(String().Format("Lanczos-%d lookup table exceeds the weight error tolerance.", n));
+                lanczosChecked = true;
+            }
         }
     }
 
@@ -996,9 +1363,17 @@ bool LuckyIntegrationInstance::ExecuteGlobal()
         {
             Image image;
             LoadImage(image, p_masterFlat.path);
-            m_masterFlatMean = image.Mean();
-            m_masterFlatImage.allocate<float>(image.Width(), image.Height());
-            m_masterFlatImage.copyRaw(image.PixelData());
+            float flatMean = image.Mean();
+            m_masterFlatScaleImage.allocate<float>(image.Width(), image.Height());
+            m_masterFlatScaleImage.copyRaw(image.PixelData());
+            // Store the flat as a per-pixel gain so calibration multiplies instead of divides
+            auto flat = m_masterFlatScaleImage.view<float>();
+            for (int y = 0; y < flat.height; y++)
+            {
+                float* row = flat.row(y);
+                for (int x = 0; x < flat.width; x++)
+                    row[x] = flatMean / row[x];
+            }
             m_hasFlat = true;
         }
         doImageIntegration();
@@ -1019,6 +1394,20 @@ void* LuckyIntegrationInstance::LockParameter(const MetaParameter* p, size_type
         return &p_minPeak;
     if (p == TheLISaturationThresholdParameter)
         return &p_saturationThreshold;
+    if (p == TheLIPSFModelParameter)
+        return &p_psfModel;
+    if (p == TheLITrackingModeParameter)
+        return &p_trackingMode;
+    if (p == TheLIMotionPredictionParameter)
+        return &p_motionPrediction;
+    if (p == TheLITrackingWindowParameter)
+        return &p_trackingWindow;
+    if (p == TheLIRedetectionIntervalParameter)
+        return &p_redetectionInterval;
+    if (p == TheLIRedetectionThresholdParameter)
+        return &p_redetectionThreshold;
+    if (p == TheLIExportDetectionsXMLParameter)
+        return &p_exportDetectionsXML;
     if (p == TheLIMasterDarkPathParameter)
         return p_masterDark.path.Begin();
     if (p == TheLIMasterFlatPathParameter)
@@ -1027,6 +1416,10 @@ void* LuckyIntegrationInstance::LockParameter(const MetaParameter* p, size_type
         return &p_pedestal;
     if (p == TheLIEnableDigitalAOParameter)
         return &p_enableDigitalAO;
+    if (p == TheLIDigitalAOModelParameter)
+        return &p_digitalAOModel;
+    if (p == TheLIDigitalAOGridSpacingParameter)
+        return &p_digitalAOGridSpacing;
     if (p == TheLIStarSizeRejectionThresholdParameter)
         return &p_starSizeRejectionThreshold;
     if (p == TheLIStarMovementRejectionThresholdParameter)
@@ -1035,6 +1428,8 @@ void* LuckyIntegrationInstance::LockParameter(const MetaParameter* p, size_type
         return &p_interpolation;
     if (p == TheLIFramePercentageParameter)
         return &p_framePercentage;
+    if (p == TheLISelectionMetricParameter)
+        return &p_selectionMetric;
     if (p == TheLIRegistrationOnlyParameter)
         return &p_registrationOnly;
     if (p == TheLIRegistrationOutputPathParameter)
@@ -1095,6 +1490,8 @@ void LuckyIntegrationInstance::doStarDetectionPreview()
     Console console;
 
     console.WriteLn("Detecting stars...");
+    m_starDetections.clear();
+    m_trackingStates.Clear();
     ImageThread::dispatch<StarDetectionThread>(this, 1);
 
     ImageVariant starDetectionPreview;
@@ -1118,31 +1515,65 @@ void LuckyIntegrationInstance::doStarDetectionAlignment()
     Console console;
 
     console.WriteLn("Detecting stars and calculating movement...");
+    // Reset before any worker starts: worker 0 may store frame 0 while the
+    // others are still being constructed
+    m_starDetections.clear();
+    m_trackingStates.Clear();
     ImageThread::dispatch<StarDetectionThread>(this);
 
-    if (m_starDetections.Length() == 0)
+    if (m_starDetections.isEmpty())
         throw Error("No star detected.");
 
-    String xmlFilename = p_inputPath + "\\star_detections.xml";
-    console.WriteLn(String("Writing detections to ") + xmlFilename + "...");
+    if (p_trackingMode == LITrackingMode::Independent)
+        linkStarTracks();
 
-    XMLElement* e1 = new XMLElement("StarDetection", XMLAttributeList() << XMLAttribute("version", "1.0"));
-    for (int i = 0; i < m_starDetections.Length(); i++)
+    if (m_trackingStates.Length() > 1)
     {
-        XMLElement* e2 = new XMLElement(*e1, "Frame", XMLAttributeList() << XMLAttribute("id", String(i)));
-        for (int j = 0; j < m_starDetections[i].Length(); j++)
+        double sum = 0.0;
+        size_t worst = 1;
+        for (size_t i = 1; i < m_trackingStates.Length(); i++)
         {
-            const Star& s = m_starDetections[i][j];
-            XMLElement* e3 = new XMLElement(*e2, "Star", XMLAttributeList() << XMLAttribute("id", String(s.id)) << XMLAttribute("x", String(s.x)) << XMLAttribute("y", String(s.y))
-                                                                            << XMLAttribute("background", String(s.background)) << XMLAttribute("peak", String(s.peak))
-                                                                            << XMLAttribute("sizeX", String(s.sizeX)) << XMLAttribute("sizeY", String(s.sizeY)));
+            sum += m_trackingStates[i].residual;
+            if (m_trackingStates[i].residual > m_trackingStates[worst].residual)
+                worst = i;
         }
+        console.WriteLn(String().Format("Prediction residual: mean %.2f px, max %.2f px at frame %u.",
+                                        sum / (m_trackingStates.Length() - 1), m_trackingStates[worst].residual, unsigned(worst)));
+        int recovered = 0;
+        for (const auto& t : m_trackingStates)
+            recovered += t.recovered;
+        if (recovered > 0)
+            console.WriteLn(String().Format("Re-detection revived %d lost star positions.", recovered));
+    }
+
+    String binFilename = p_inputPath + "\\star_detections.bin";
+    console.WriteLn(String("Writing detections to ") + binFilename + "...");
+    File file;
+    file.CreateForWriting(binFilename);
+    m_starDetections.write([&](const void* data, size_t size)
+                           {
+                               if (size > 0)
+                                   file.Write(data, size);
+                           });
+    file.Close();
+
+    String frameFilename = p_inputPath + "\\frame_transforms.bin";
+    console.WriteLn(String("Writing frame transforms to ") + frameFilename + "...");
+    m_frames.build(m_starDetections);
+    file.CreateForWriting(frameFilename);
+    m_frames.write([&](const void* data, size_t size)
+                   {
+                       if (size > 0)
+                           file.Write(data, size);
+                   });
+    file.Close();
+
+    if (p_exportDetectionsXML)
+    {
+        String xmlFilename = p_inputPath + "\\star_detections.xml";
+        console.WriteLn(String("Exporting detections to ") + xmlFilename + "...");
+        writeStarDetectionsXML(xmlFilename);
     }
-    XMLDocument xml;
-    xml.SetXML("1.0");
-    xml.SetRootElement(e1);
-    xml.EnableAutoFormatting();
-    xml.SerializeToFile(xmlFilename);
 
     ImageVariant starMovementImage;
     starMovementImage.CreateFloatImage();
@@ -1160,14 +1591,87 @@ void LuckyIntegrationInstance::doStarDetectionAlignment()
     w.Show();
 }
 
-void LuckyIntegrationInstance::doImageIntegration()
+void LuckyIntegrationInstance::writeStarDetectionsXML(const String& xmlFilename) const
 {
-    Console console;
+    XMLElement* e1 = new XMLElement("StarDetection", XMLAttributeList() << XMLAttribute("version", "1.0"));
+    Array<Star> stars;
+    for (int i = 0; i < m_starDetections.numFrames(); i++)
+    {
+        XMLAttributeList frameAttributes;
+        frameAttributes << XMLAttribute("id", String(i));
+        if (i < m_trackingStates.Length())
+            frameAttributes << XMLAttribute("predictionResidual", String(m_trackingStates[i].residual));
+        XMLElement* e2 = new XMLElement(*e1, "Frame", frameAttributes);
+        getStars(stars, m_starDetections, i);
+        for (const Star& s : stars)
+        {
+            XMLElement* e3 = new XMLElement(*e2, "Star", XMLAttributeList() << XMLAttribute("id", String(s.id)) << XMLAttribute("x", String(s.x)) << XMLAttribute("y", String(s.y))
+                                                                            << XMLAttribute("background", String(s.background)) << XMLAttribute("peak", String(s.peak))
+                                                                            << XMLAttribute("sizeX", String(s.sizeX)) << XMLAttribute("sizeY", String(s.sizeY))
+                                                                            << XMLAttribute("fwhm", String(s.fwhm)) << XMLAttribute("ellipticity", String(s.ellipticity))
+                                                                            << XMLAttribute("angle", String(s.angle)) << XMLAttribute("flux", String(s.flux)));
+        }
+    }
+    XMLDocument xml;
+    xml.SetXML("1.0");
+    xml.SetRootElement(e1);
+    xml.EnableAutoFormatting();
+    xml.SerializeToFile(xmlFilename);
+}
 
-    String xmlFilename = p_inputPath + "\\star_detections.xml";
-    console.WriteLn(String("Reading detections from ") + xmlFilename + "...");
+void LuckyIntegrationInstance::linkStarTracks()
+{
+    // Frames tracked independently can lock a star onto a neighbour, and lose
+    // stars without leaving a usable position. Stars moving further than the
+    // tracking window from the median motion of their frame are unlinked, and
+    // lost stars are placed at their reference position plus that motion.
+    NativeStarTable& table = m_starDetections;
+    const float* x0 = table.row(0, NativeStarTable::X);
+    const float* y0 = table.row(0, NativeStarTable::Y);
+    float range = float(p_approxFwhm * p_trackingWindow);
+    std::vector<float> dx, dy;
+    int unlinked = 0;
+    for (int i = 1; i < table.numFrames(); i++)
+    {
+        float* x = table.row(i, NativeStarTable::X);
+        float* y = table.row(i, NativeStarTable::Y);
+        float* peak = table.row(i, NativeStarTable::Peak);
+        dx.clear();
+        dy.clear();
+        for (int j = 0; j < table.numStars(); j++)
+            if (table.isValid(i, j))
+            {
+                dx.push_back(x[j] - x0[j]);
+                dy.push_back(y[j] - y0[j]);
+            }
+        if (dx.empty())
+            continue;
+        std::nth_element(dx.begin(), dx.begin() + dx.size() / 2, dx.end());
+        std::nth_element(dy.begin(), dy.begin() + dy.size() / 2, dy.end());
+        float mx = dx[dx.size() / 2], my = dy[dy.size() / 2];
+        for (int j = 0; j < table.numStars(); j++)
+        {
+            float ex = x[j] - x0[j] - mx, ey = y[j] - y0[j] - my;
+            if (table.isValid(i, j) && (ex * ex + ey * ey > range * range))
+            {
+                table.setValid(i, j, false);
+                peak[j] = 0.0f;
+                unlinked++;
+            }
+            if (!table.isValid(i, j))
+            {
+                x[j] = x0[j] + mx;
+                y[j] = y0[j] + my;
+            }
+        }
+    }
+    if (unlinked > 0)
+        Console().WriteLn(String().Format("Unlinked %d star positions inconsistent with their frame's motion.", unlinked));
+}
 
-    m_starDetections.Clear();
+void LuckyIntegrationInstance::readStarDetectionsXML(const String& xmlFilename)
+{
+    m_starDetections.clear();
     XMLDocument xml;
     xml.Parse(File::ReadTextFile(xmlFilename).UTF8ToUTF16());
  
@@ -1185,7 +1689,7 @@ void LuckyIntegrationInstance::doImageIntegration()
         {
             if (e3.Name() != "Star")
                 throw Error("Unrecognized element " + e3.Name());
-            Star s;
+            Star s{};
             s.id = e3.AttributeValue("id").ToInt();
             s.x = e3.AttributeValue("x").ToFloat();
             s.y = e3.AttributeValue("y").ToFloat();
@@ -1193,13 +1697,94 @@ void LuckyIntegrationInstance::doImageIntegration()
             s.peak = e3.AttributeValue("peak").ToFloat();
             s.sizeX = e3.AttributeValue("sizeX").ToFloat();
             s.sizeY = e3.AttributeValue("sizeY").ToFloat();
+            // PSF shape attributes are absent from files written before 2D fitting
+            if (e3.HasAttribute("fwhm"))
+            {
+                s.fwhm = e3.AttributeValue("fwhm").ToFloat();
+                s.ellipticity = e3.AttributeValue("ellipticity").ToFloat();
+                s.angle = e3.AttributeValue("angle").ToFloat();
+                s.flux = e3.AttributeValue("flux").ToFloat();
+            }
             stars.Append(s);
         }
-        m_starDetections.Append(stars);
+        int frame = m_starDetections.numFrames();
+        if (frame == 0)
+            m_starDetections.reset(int(stars.Length()));
+        else if (int(stars.Length()) != m_starDetections.numStars())
+            throw Error(String().Format("Frame #%d has %d stars, expected %d.", frame, int(stars.Length()), m_starDetections.numStars()));
+        setStars(m_starDetections, frame, stars);
+    }
+}
+
+void LuckyIntegrationInstance::doImageIntegration()
+{
+    Console console;
+
+    // Integration only needs the frame transforms. Sessions aligned before
+    // they were written derive them from the star detections, and the oldest
+    // ones only have the XML detection file.
+    String frameFilename = p_inputPath + "\\frame_transforms.bin";
+    String binFilename = p_inputPath + "\\star_detections.bin";
+    String xmlFilename = p_inputPath + "\\star_detections.xml";
+    if (File::Exists(frameFilename))
+    {
+        console.WriteLn(String("Reading frame transforms from ") + frameFilename + "...");
+        File file;
+        file.OpenForReading(frameFilename);
+        bool ok = m_frames.read([&](void* data, size_t size)
+                                {
+                                    if (size > 0)
+                                        file.Read(data, size);
+                                }, uint64_t(file.Size()));
+        file.Close();
+        if (!ok)
+            throw Error("Invalid frame transform file: " + frameFilename);
+    }
+    else
+    {
+        if (File::Exists(binFilename) || !File::Exists(xmlFilename))
+        {
+            console.WriteLn(String("Mapping detections from ") + binFilename + "...");
+            if (!m_starDetections.map(binFilename.ToUTF8().c_str()))
+                throw Error("Unable to map star detection file: " + binFilename);
+        }
+        else
+        {
+            console.WriteLn(String("Reading detections from ") + xmlFilename + "...");
+            readStarDetectionsXML(xmlFilename);
+        }
+        m_frames.build(m_starDetections);
+        m_starDetections.clear();   // unmaps the detection file
     }
+    if (m_frames.isEmpty())
+        throw Error("No frame in the star detections.");
+
+    console.WriteLn(String().Format("Got transforms of %d frames. Each frame has %d stars.", m_frames.numFrames(), m_frames.numStars()));
 
-    console.WriteLn(String().Format("Got %d frames of star detections. Each frame has %d stars.", m_starDetections.Length(), m_starDetections[0].Length()));
+    if (p_enableDigitalAO && (p_digitalAOModel == LIDigitalAOModel::PiecewiseAffine))
+    {
+        // The reference frame is triangulated and rasterized once and then
+        // shared by the workers. The stars live in the reference frame are
+        // its controls.
+        const NativeFrameControl* controls = m_frames.controls(0);
+        std::vector<NativeControlPoint> vertices;
+        m_aoMeshStars.Clear();
+        for (uint32_t i = 0; i < m_frames.transform(0).numControls; i++)
+        {
+            int star = controls[i].star;
+            vertices.push_back({ m_frames.referenceX(star), m_frames.referenceY(star), 0.0f, 0.0f });
+            m_aoMeshStars.Append(star);
+        }
+        if (vertices.size() < 3)
+            throw Error("Piecewise affine digital AO requires at least 3 stars in the first frame.");
+        m_aoMesh.triangulate(vertices);
+        int width, height;
+        GetImageSize(FindInputFiles(p_inputPath)[0], width, height);
+        m_aoMesh.rasterize(width, height);
+        console.WriteLn(String().Format("Triangulated %d reference stars into %d triangles.", int(vertices.size()), m_aoMesh.numTriangles()));
+    }
 
+    console.WriteLn(String("Using ") + NativeKernels::get().name + " pixel arithmetic kernels.");
     if (p_registrationOnly)
         console.WriteLn("Running image registration...");
     else
@@ -1208,6 +1793,8 @@ void LuckyIntegrationInstance::doImageIntegration()
     ImageThread::dispatch<ImageIntegrationThread>(this);
     if ((m_numIntegratedImages > 0) && !p_registrationOnly)
         m_integration.divConst(m_numIntegratedImages);
+    if ((m_numTotalImages == 0) || (m_numIntegratedImages == 0))   // No frame was read at all
+        throw Error("All frames were rejected.");
     console.WriteLn(String().Format("Rejection percentage: %.3f%%", 100.0f - 100.0f * m_numIntegratedImages / m_numTotalImages));
 
     m_averageProcessTimeMs /= m_numIntegratedImages;
@@ -5,7 +5,10 @@
 #include <pcl/MetaParameter.h> // pcl_enum
 #include <pcl/Mutex.h>
 
-#include "NativeImage.h"
+#include "NativeImageAnalysis.h"
+#include "NativeImageRegistration.h"
+#include "NativeFrameTable.h"
+#include "NativeStarTable.h"
 
 namespace pcl
 {
@@ -19,6 +22,19 @@ struct Star
     float peak;
     float sizeX;
     float sizeY;
+    float fwhm;
+    float ellipticity;
+    float angle;
+    float flux;
+};
+
+struct TrackingState
+{
+    NativeMotionFilter filter;  // field motion filtered up to this frame
+    float offsetX;              // measured mean star offset from the reference frame
+    float offsetY;
+    float residual;             // distance between the measured and predicted offsets
+    int recovered;              // lost stars revived by re-detection
 };
 
 class LuckyIntegrationInstance : public ProcessImplementation
@@ -60,27 +76,40 @@ private:
     double p_approxFwhm;
     double p_minPeak;
     double p_saturationThreshold;
+    pcl_enum p_psfModel;
+    pcl_enum p_trackingMode;
+    pcl_bool p_motionPrediction;
+    double p_trackingWindow;
+    double p_redetectionInterval;
+    double p_redetectionThreshold;
+    pcl_bool p_exportDetectionsXML;
     ImageItem p_masterDark;
     ImageItem p_masterFlat;
     double p_pedestal;
     pcl_bool p_enableDigitalAO;
+    pcl_enum p_digitalAOModel;
+    double p_digitalAOGridSpacing;
     double p_starSizeRejectionThreshold;
     double p_starMovementRejectionThreshold;
     pcl_enum p_interpolation;
     double p_framePercentage;
+    pcl_enum p_selectionMetric;
     pcl_bool p_registrationOnly;
     String p_registrationOutputPath;
 
     NativeImage m_masterDarkImage;
-    NativeImage m_masterFlatImage;
-    float m_masterFlatMean;
+    NativeImage m_masterFlatScaleImage;  // master flat mean / master flat
     bool m_hasDark;
     bool m_hasFlat;
 
-    NativeImage m_backgroundImage;
+    NativeBackgroundMesh m_background;
     NativeImage m_starDetectionPreviewImage;
-    Array<Array<Star>> m_starDetections;
+    NativeStarTable m_starDetections;   // frames x stars, star index as column
+    NativeFrameTable m_frames;          // per-frame transforms consumed by integration
+    Array<TrackingState> m_trackingStates;
     Mutex m_starDetectionLock;
+    NativePiecewiseAffineWarp m_aoMesh;  // digital AO triangulation of frame 0
+    Array<int> m_aoMeshStars;           // star index of each mesh vertex
     NativeImage m_starMovementImage;
     NativeImage m_integration;
     NativeImage m_weight;
@@ -91,6 +120,9 @@ private:
     void doStarDetectionPreview();
     void doStarDetectionAlignment();
     void doImageIntegration();
+    void linkStarTracks();
+    void writeStarDetectionsXML(const String& xmlFilename) const;
+    void readStarDetectionsXML(const String& xmlFilename);
 
     friend class LuckyIntegrationProcess;
     friend class LuckyIntegrationInterface;
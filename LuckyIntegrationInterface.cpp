@@ -137,6 +137,14 @@ void LuckyIntegrationInterface::UpdateStarControl()
 	GUI->ApproxFWHM_NumericControl.SetValue(m_instance.p_approxFwhm);
 	GUI->MinPeak_NumericControl.SetValue(m_instance.p_minPeak);
 	GUI->SaturationThreshold_NumericControl.SetValue(m_instance.p_saturationThreshold);
+	GUI->PSFModel_ComboBox.SetCurrentItem(m_instance.p_psfModel);
+	GUI->TrackingMode_ComboBox.SetCurrentItem(m_instance.p_trackingMode);
+	GUI->TrackingWindow_NumericControl.SetValue(m_instance.p_trackingWindow);
+	GUI->MotionPrediction_CheckBox.SetChecked(m_instance.p_motionPrediction);
+	GUI->MotionPrediction_CheckBox.Enable(m_instance.p_trackingMode == LITrackingMode::Sequential);
+	GUI->RedetectionInterval_NumericControl.SetValue(m_instance.p_redetectionInterval);
+	GUI->RedetectionThreshold_NumericControl.SetValue(m_instance.p_redetectionThreshold);
+	GUI->ExportDetectionsXML_CheckBox.SetChecked(m_instance.p_exportDetectionsXML);
 }
 
 void LuckyIntegrationInterface::UpdateCalibrationControl()
@@ -149,9 +157,14 @@ void LuckyIntegrationInterface::UpdateCalibrationControl()
 void LuckyIntegrationInterface::UpdateIntegrationControl()
 {
 	GUI->EnableDigitalAO_CheckBox.SetChecked(m_instance.p_enableDigitalAO);
+	GUI->DigitalAOGridSpacing_NumericControl.SetValue(m_instance.p_digitalAOGridSpacing);
+	GUI->DigitalAOModel_ComboBox.SetCurrentItem(m_instance.p_digitalAOModel);
+	GUI->DigitalAOModel_ComboBox.Enable(m_instance.p_enableDigitalAO);
+	GUI->DigitalAOGridSpacing_NumericControl.Enable(m_instance.p_enableDigitalAO && (m_instance.p_digitalAOModel == LIDigitalAOModel::InverseDistance));
 	GUI->StarSizeRejectionThreshold_NumericControl.SetValue(m_instance.p_starSizeRejectionThreshold);
 	GUI->StarMovementRejectionThreshold_NumericControl.SetValue(m_instance.p_starMovementRejectionThreshold);
 	GUI->FramePercentage_NumericControl.SetValue(m_instance.p_framePercentage);
+	GUI->SelectionMetric_ComboBox.SetCurrentItem(m_instance.p_selectionMetric);
 	GUI->RegistrationOnly_CheckBox.SetChecked(m_instance.p_registrationOnly);
 	GUI->RegistrationOutputPath_Edit.SetText(m_instance.p_registrationOutputPath);
 }
@@ -168,6 +181,30 @@ void LuckyIntegrationInterface::__Interpolation_ItemSelected(ComboBox& /*sender*
 	UpdateInterpolationControl();
 }
 
+void LuckyIntegrationInterface::__PSFModel_ItemSelected(ComboBox& /*sender*/, int itemIndex)
+{
+	m_instance.p_psfModel = itemIndex;
+	UpdateStarControl();
+}
+
+void LuckyIntegrationInterface::__TrackingMode_ItemSelected(ComboBox& /*sender*/, int itemIndex)
+{
+	m_instance.p_trackingMode = itemIndex;
+	UpdateStarControl();
+}
+
+void LuckyIntegrationInterface::__DigitalAOModel_ItemSelected(ComboBox& /*sender*/, int itemIndex)
+{
+	m_instance.p_digitalAOModel = itemIndex;
+	UpdateIntegrationControl();
+}
+
+void LuckyIntegrationInterface::__SelectionMetric_ItemSelected(ComboBox& /*sender*/, int itemIndex)
+{
+	m_instance.p_selectionMetric = itemIndex;
+	UpdateIntegrationControl();
+}
+
 void LuckyIntegrationInterface::e_InputPath_Click(Button& sender, bool checked)
 {
 	if (sender == GUI->InputPath_ToolButton)
@@ -237,6 +274,15 @@ void LuckyIntegrationInterface::e_Calibration_EditCompleted(Edit& sender)
 	sender.SetText(text);
 }
 
+void LuckyIntegrationInterface::e_StarDetection_Click(Button& sender, bool checked)
+{
+	if (sender == GUI->MotionPrediction_CheckBox)
+		m_instance.p_motionPrediction = checked;
+	else if (sender == GUI->ExportDetectionsXML_CheckBox)
+		m_instance.p_exportDetectionsXML = checked;
+	UpdateStarControl();
+}
+
 void LuckyIntegrationInterface::e_Integration_Click(Button& sender, bool checked)
 {
 	if (sender == GUI->EnableDigitalAO_CheckBox)
@@ -273,8 +319,16 @@ void LuckyIntegrationInterface::__EditValueUpdated(NumericEdit& sender, double v
 		m_instance.p_minPeak = value;
 	else if (sender == GUI->SaturationThreshold_NumericControl)
 		m_instance.p_saturationThreshold = value;
+	else if (sender == GUI->TrackingWindow_NumericControl)
+		m_instance.p_trackingWindow = value;
+	else if (sender == GUI->RedetectionInterval_NumericControl)
+		m_instance.p_redetectionInterval = value;
+	else if (sender == GUI->RedetectionThreshold_NumericControl)
+		m_instance.p_redetectionThreshold = value;
 	else if (sender == GUI->Pedestal_NumericControl)
 		m_instance.p_pedestal = value;
+	else if (sender == GUI->DigitalAOGridSpacing_NumericControl)
+		m_instance.p_digitalAOGridSpacing = value;
 	else if (sender == GUI->StarSizeRejectionThreshold_NumericControl)
 		m_instance.p_starSizeRejectionThreshold = value;
 	else if (sender == GUI->StarMovementRejectionThreshold_NumericControl)
@@ -379,10 +433,99 @@ LuckyIntegrationInterface::GUIData::GUIData(LuckyIntegrationInterface& w)
 	SaturationThreshold_NumericControl.SetToolTip("<p>A star with peak value above this threshold will be excluded.</p>");
 	SaturationThreshold_NumericControl.OnValueUpdated((NumericEdit::value_event_handler)&LuckyIntegrationInterface::__EditValueUpdated, w);
 
+	const char* psfModelToolTip = "<p>Star profile model used to measure star sizes.</p>"
+								  "<p><b>Separable</b>: Independent 1D Gaussians fitted along the x and y axes through the star center.</p>"
+								  "<p><b>Gaussian</b>: Elliptical 2D Gaussian, giving FWHM, ellipticity, angle and flux.</p>"
+								  "<p><b>Moffat</b>: Elliptical 2D Moffat profile with beta = 4, which follows the extended wings of seeing-limited stars "
+								  "more closely than a Gaussian at about twice the cost.</p>"
+								  "<p>With the 2D models, star sizes are the extents of the half-maximum ellipse rather than 1D FWHMs, so the star size "
+								  "rejection threshold may need retuning, and stars whose fit fails are dropped from the frame.</p>";
+	PSFModel_Label.SetText("PSF Model:");
+	PSFModel_Label.SetFixedWidth(labelWidth1);
+	PSFModel_Label.SetTextAlignment(TextAlign::Right | TextAlign::VertCenter);
+	PSFModel_Label.SetToolTip(psfModelToolTip);
+	PSFModel_ComboBox.AddItem("Separable");
+	PSFModel_ComboBox.AddItem("Gaussian");
+	PSFModel_ComboBox.AddItem("Moffat");
+	PSFModel_ComboBox.SetToolTip(psfModelToolTip);
+	PSFModel_ComboBox.OnItemSelected((ComboBox::item_event_handler)&LuckyIntegrationInterface::__PSFModel_ItemSelected, w);
+	PSFModel_Sizer.SetSpacing(4);
+	PSFModel_Sizer.Add(PSFModel_Label);
+	PSFModel_Sizer.Add(PSFModel_ComboBox);
+	PSFModel_Sizer.AddStretch();
+
+	const char* trackingModeToolTip = "<p><b>Sequential</b>: Each frame is tracked from the star positions of the previous frame. "
+									  "Frames are processed one after another.</p>"
+									  "<p><b>Independent</b>: Each frame is tracked from the reference frame, after estimating its shift from the brightest stars, "
+									  "so frames are tracked in parallel. A final pass unlinks stars that do not follow the motion of their frame.</p>";
+	TrackingMode_Label.SetText("Tracking Mode:");
+	TrackingMode_Label.SetFixedWidth(labelWidth1);
+	TrackingMode_Label.SetTextAlignment(TextAlign::Right | TextAlign::VertCenter);
+	TrackingMode_Label.SetToolTip(trackingModeToolTip);
+	TrackingMode_ComboBox.AddItem("Sequential");
+	TrackingMode_ComboBox.AddItem("Independent");
+	TrackingMode_ComboBox.SetToolTip(trackingModeToolTip);
+	TrackingMode_ComboBox.OnItemSelected((ComboBox::item_event_handler)&LuckyIntegrationInterface::__TrackingMode_ItemSelected, w);
+	TrackingMode_Sizer.SetSpacing(4);
+	TrackingMode_Sizer.Add(TrackingMode_Label);
+	TrackingMode_Sizer.Add(TrackingMode_ComboBox);
+	TrackingMode_Sizer.AddStretch();
+
+	TrackingWindow_NumericControl.label.SetText("Tracking Window:");
+	TrackingWindow_NumericControl.label.SetFixedWidth(labelWidth1);
+	TrackingWindow_NumericControl.slider.SetRange(0, 300);
+	TrackingWindow_NumericControl.slider.SetScaledMinWidth(300);
+	TrackingWindow_NumericControl.SetReal();
+	TrackingWindow_NumericControl.SetRange(TheLITrackingWindowParameter->MinimumValue(), TheLITrackingWindowParameter->MaximumValue());
+	TrackingWindow_NumericControl.SetPrecision(TheLITrackingWindowParameter->Precision());
+	TrackingWindow_NumericControl.edit.SetFixedWidth(editWidth1);
+	TrackingWindow_NumericControl.SetToolTip("<p>Half size of the window in which each star is searched for in the next frame, in units of the approximate FWHM.</p>"
+											 "<p>With motion prediction the window follows the drift of the field and can be made smaller.</p>");
+	TrackingWindow_NumericControl.OnValueUpdated((NumericEdit::value_event_handler)&LuckyIntegrationInterface::__EditValueUpdated, w);
+
+	MotionPrediction_CheckBox.SetText("Motion Prediction");
+	MotionPrediction_CheckBox.SetToolTip("<p>Predict the motion of the field with a constant-velocity Kalman filter, and center the tracking windows "
+										 "on the predicted star positions.</p>"
+										 "<p>Only applies to sequential tracking. The mean and maximum prediction residuals are reported after alignment.</p>");
+	MotionPrediction_CheckBox.OnClick((Button::click_event_handler)&LuckyIntegrationInterface::e_StarDetection_Click, w);
+
+	RedetectionInterval_NumericControl.label.SetText("Re-detection Interval:");
+	RedetectionInterval_NumericControl.label.SetFixedWidth(labelWidth1);
+	RedetectionInterval_NumericControl.slider.SetRange(0, 500);
+	RedetectionInterval_NumericControl.slider.SetScaledMinWidth(300);
+	RedetectionInterval_NumericControl.SetInteger();
+	RedetectionInterval_NumericControl.SetRange(TheLIRedetectionIntervalParameter->MinimumValue(), TheLIRedetectionIntervalParameter->MaximumValue());
+	RedetectionInterval_NumericControl.edit.SetFixedWidth(editWidth1);
+	RedetectionInterval_NumericControl.SetToolTip("<p>Every this many frames, lost stars are searched for around their expected positions and revived when found. "
+												  "Zero disables periodic re-detection.</p>");
+	RedetectionInterval_NumericControl.OnValueUpdated((NumericEdit::value_event_handler)&LuckyIntegrationInterface::__EditValueUpdated, w);
+
+	RedetectionThreshold_NumericControl.label.SetText("Re-detection Threshold:");
+	RedetectionThreshold_NumericControl.label.SetFixedWidth(labelWidth1);
+	RedetectionThreshold_NumericControl.slider.SetRange(0, 100);
+	RedetectionThreshold_NumericControl.slider.SetScaledMinWidth(300);
+	RedetectionThreshold_NumericControl.SetInteger();
+	RedetectionThreshold_NumericControl.SetRange(TheLIRedetectionThresholdParameter->MinimumValue(), TheLIRedetectionThresholdParameter->MaximumValue());
+	RedetectionThreshold_NumericControl.edit.SetFixedWidth(editWidth1);
+	RedetectionThreshold_NumericControl.SetToolTip("<p>Lost stars are also searched for in any frame where the percentage of tracked stars falls below this threshold.</p>");
+	RedetectionThreshold_NumericControl.OnValueUpdated((NumericEdit::value_event_handler)&LuckyIntegrationInterface::__EditValueUpdated, w);
+
+	ExportDetectionsXML_CheckBox.SetText("Export XML");
+	ExportDetectionsXML_CheckBox.SetToolTip("<p>Also write the star detections to star_detections.xml in the input directory, for inspection. "
+											"Integration reads the binary star_detections.bin file.</p>");
+	ExportDetectionsXML_CheckBox.OnClick((Button::click_event_handler)&LuckyIntegrationInterface::e_StarDetection_Click, w);
+
 	StarDetection_Sizer.SetSpacing(4);
 	StarDetection_Sizer.Add(ApproxFWHM_NumericControl);
 	StarDetection_Sizer.Add(MinPeak_NumericControl);
 	StarDetection_Sizer.Add(SaturationThreshold_NumericControl);
+	StarDetection_Sizer.Add(PSFModel_Sizer);
+	StarDetection_Sizer.Add(TrackingMode_Sizer);
+	StarDetection_Sizer.Add(TrackingWindow_NumericControl);
+	StarDetection_Sizer.Add(MotionPrediction_CheckBox);
+	StarDetection_Sizer.Add(RedetectionInterval_NumericControl);
+	StarDetection_Sizer.Add(RedetectionThreshold_NumericControl);
+	StarDetection_Sizer.Add(ExportDetectionsXML_CheckBox);
 	StarDetection_Sizer.AddStretch();
 
 	StarDetection_Control.SetSizer(StarDetection_Sizer);
@@ -475,6 +618,34 @@ LuckyIntegrationInterface::GUIData::GUIData(LuckyIntegrationInterface& w)
 										"<p>When disabled, registration and pixel rejection will be done based on the average movement and size of all detected stars.</p>");
 	EnableDigitalAO_CheckBox.OnClick((Button::click_event_handler)& LuckyIntegrationInterface::e_Integration_Click, w);
 
+	const char* digitalAOModelToolTip = "<p><b>Inverse Distance</b>: The displacement of each pixel is the inverse-distance weighted average of the star displacements, "
+										"evaluated on a coarse grid.</p>"
+										"<p><b>Piecewise Affine</b>: The stars of the first frame are triangulated once, and each triangle is warped with the affine transform "
+										"that follows its three stars. Corrects seeing locally; pixels outside the triangulation follow the average displacement.</p>";
+	DigitalAOModel_Label.SetText("Digital AO Model:");
+	DigitalAOModel_Label.SetFixedWidth(labelWidth1);
+	DigitalAOModel_Label.SetTextAlignment(TextAlign::Right | TextAlign::VertCenter);
+	DigitalAOModel_Label.SetToolTip(digitalAOModelToolTip);
+	DigitalAOModel_ComboBox.AddItem("Inverse Distance");
+	DigitalAOModel_ComboBox.AddItem("Piecewise Affine");
+	DigitalAOModel_ComboBox.SetToolTip(digitalAOModelToolTip);
+	DigitalAOModel_ComboBox.OnItemSelected((ComboBox::item_event_handler)&LuckyIntegrationInterface::__DigitalAOModel_ItemSelected, w);
+	DigitalAOModel_Sizer.SetSpacing(4);
+	DigitalAOModel_Sizer.Add(DigitalAOModel_Label);
+	DigitalAOModel_Sizer.Add(DigitalAOModel_ComboBox);
+	DigitalAOModel_Sizer.AddStretch();
+
+	DigitalAOGridSpacing_NumericControl.label.SetText("Digital AO Grid Spacing:");
+	DigitalAOGridSpacing_NumericControl.label.SetFixedWidth(labelWidth1);
+	DigitalAOGridSpacing_NumericControl.slider.SetRange(4, 256);
+	DigitalAOGridSpacing_NumericControl.slider.SetScaledMinWidth(300);
+	DigitalAOGridSpacing_NumericControl.SetInteger();
+	DigitalAOGridSpacing_NumericControl.SetRange(TheLIDigitalAOGridSpacingParameter->MinimumValue(), TheLIDigitalAOGridSpacingParameter->MaximumValue());
+	DigitalAOGridSpacing_NumericControl.edit.SetFixedWidth(editWidth1);
+	DigitalAOGridSpacing_NumericControl.SetToolTip("<p>Distance in pixels between the control points where the digital AO displacement field is computed from the detected stars. "
+												   "Displacements in between are interpolated. Smaller values follow local seeing more closely at a higher cost.</p>");
+	DigitalAOGridSpacing_NumericControl.OnValueUpdated((NumericEdit::value_event_handler)&LuckyIntegrationInterface::__EditValueUpdated, w);
+
 	StarSizeRejectionThreshold_NumericControl.label.SetText("Star Size Rejection Threshold:");
 	StarSizeRejectionThreshold_NumericControl.label.SetFixedWidth(labelWidth1);
 	StarSizeRejectionThreshold_NumericControl.slider.SetRange(0, 500);
@@ -500,7 +671,8 @@ LuckyIntegrationInterface::GUIData::GUIData(LuckyIntegrationInterface& w)
 	// Routine
 	const char* interpolationToolTip = "<p><b>Nearest</b>: No interpolation. Fastest processing but poor results.</p>"
 									   "<p><b>Bilinear</b>: Suitable for low SNR images. Fast with OK results.</p>"
-									   "<p><b>Lanczos</b>: Suitable for medium to high SNR images. Best interpolation algorithm for image registration without rescaling. Slow processing but best results.</p>";
+									   "<p><b>Lanczos</b>: Suitable for medium to high SNR images. Best interpolation algorithm for image registration without rescaling. Slow processing but best results.</p>"
+									   "<p>Lanczos-4 and Lanczos-5 use a wider filter support for slightly sharper results at a higher cost.</p>";
 	Interpolation_Lable.SetText("Interpolation:");
 	Interpolation_Lable.SetFixedWidth(labelWidth1);
 	Interpolation_Lable.SetTextAlignment(TextAlign::Right | TextAlign::VertCenter);
@@ -508,6 +680,8 @@ LuckyIntegrationInterface::GUIData::GUIData(LuckyIntegrationInterface& w)
 	Interpolation_ComboBox.AddItem("Nearest");
 	Interpolation_ComboBox.AddItem("Bilinear");
 	Interpolation_ComboBox.AddItem("Lanczos-3");
+	Interpolation_ComboBox.AddItem("Lanczos-4");
+	Interpolation_ComboBox.AddItem("Lanczos-5");
 	Interpolation_ComboBox.SetToolTip(interpolationToolTip);
 	Interpolation_ComboBox.OnItemSelected((ComboBox::item_event_handler)&LuckyIntegrationInterface::__Interpolation_ItemSelected, w);
 	Interpolation_Sizer.SetSpacing(4);
@@ -515,7 +689,7 @@ LuckyIntegrationInterface::GUIData::GUIData(LuckyIntegrationInterface& w)
 	Interpolation_Sizer.Add(Interpolation_ComboBox);
 	Interpolation_Sizer.AddStretch();
 
-	FramePercentage_NumericControl.label.SetText("Frame Percentage to Process:");
+	FramePercentage_NumericControl.label.SetText("Frame Percentage to Integrate:");
 	FramePercentage_NumericControl.label.SetFixedWidth(labelWidth1);
 	FramePercentage_NumericControl.slider.SetRange(0, 500);
 	FramePercentage_NumericControl.slider.SetScaledMinWidth(300);
@@ -523,9 +697,29 @@ LuckyIntegrationInterface::GUIData::GUIData(LuckyIntegrationInterface& w)
 	FramePercentage_NumericControl.SetRange(TheLIFramePercentageParameter->MinimumValue(), TheLIFramePercentageParameter->MaximumValue());
 	FramePercentage_NumericControl.SetPrecision(TheLIFramePercentageParameter->Precision());
 	FramePercentage_NumericControl.edit.SetFixedWidth(editWidth1);
-	FramePercentage_NumericControl.SetToolTip("<p>Specify how many frames in the input directory will be processed, in percentage.</p>");
+	FramePercentage_NumericControl.SetToolTip("<p>Percentage of the frames in the input directory to integrate. The best frames according to "
+											  "the selection metric are kept among those passing the rejection thresholds.</p>"
+											  "<p>Star detection and alignment always process every frame.</p>");
 	FramePercentage_NumericControl.OnValueUpdated((NumericEdit::value_event_handler)&LuckyIntegrationInterface::__EditValueUpdated, w);
 
+	const char* selectionMetricToolTip = "<p>How frames are ranked for the frame percentage.</p>"
+										 "<p><b>Quality</b>: Fraction of the stars tracked in the frame over the mean star area.</p>"
+										 "<p><b>Star Size</b>: Mean star size, smallest first.</p>"
+										 "<p><b>Jitter</b>: Mean star movement from the previous frame, smallest first.</p>";
+	SelectionMetric_Label.SetText("Selection Metric:");
+	SelectionMetric_Label.SetFixedWidth(labelWidth1);
+	SelectionMetric_Label.SetTextAlignment(TextAlign::Right | TextAlign::VertCenter);
+	SelectionMetric_Label.SetToolTip(selectionMetricToolTip);
+	SelectionMetric_ComboBox.AddItem("Quality");
+	SelectionMetric_ComboBox.AddItem("Star Size");
+	SelectionMetric_ComboBox.AddItem("Jitter");
+	SelectionMetric_ComboBox.SetToolTip(selectionMetricToolTip);
+	SelectionMetric_ComboBox.OnItemSelected((ComboBox::item_event_handler)&LuckyIntegrationInterface::__SelectionMetric_ItemSelected, w);
+	SelectionMetric_Sizer.SetSpacing(4);
+	SelectionMetric_Sizer.Add(SelectionMetric_Label);
+	SelectionMetric_Sizer.Add(SelectionMetric_ComboBox);
+	SelectionMetric_Sizer.AddStretch();
+
 	RegistrationOnly_CheckBox.SetText("Registration Only");
 	RegistrationOnly_CheckBox.SetToolTip("<p>Perform registration only.</p>"
 		"<p>When enabled, integration will be skipped, and registration result of each frame will be saved to the output directory which is specified below.</p>");
@@ -561,10 +755,13 @@ LuckyIntegrationInterface::GUIData::GUIData(LuckyIntegrationInterface& w)
 
 	Integration_Sizer.SetSpacing(4);
 	Integration_Sizer.Add(EnableDigitalAO_CheckBox);
+	Integration_Sizer.Add(DigitalAOModel_Sizer);
+	Integration_Sizer.Add(DigitalAOGridSpacing_NumericControl);
 	Integration_Sizer.Add(StarSizeRejectionThreshold_NumericControl);
 	Integration_Sizer.Add(StarMovementRejectionThreshold_NumericControl);
 	Integration_Sizer.Add(Interpolation_Sizer);
 	Integration_Sizer.Add(FramePercentage_NumericControl);
+	Integration_Sizer.Add(SelectionMetric_Sizer);
 	Integration_Sizer.Add(RegistrationOnly_CheckBox);
 	Integration_Sizer.Add(RegistrationOutputPath_Sizer);
 	Integration_Sizer.AddStretch();
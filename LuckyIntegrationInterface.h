@@ -59,6 +59,17 @@ private:
             NumericControl  ApproxFWHM_NumericControl;
             NumericControl  MinPeak_NumericControl;
             NumericControl  SaturationThreshold_NumericControl;
+            HorizontalSizer PSFModel_Sizer;
+                Label           PSFModel_Label;
+                ComboBox        PSFModel_ComboBox;
+            HorizontalSizer TrackingMode_Sizer;
+                Label           TrackingMode_Label;
+                ComboBox        TrackingMode_ComboBox;
+            NumericControl  TrackingWindow_NumericControl;
+            CheckBox        MotionPrediction_CheckBox;
+            NumericControl  RedetectionInterval_NumericControl;
+            NumericControl  RedetectionThreshold_NumericControl;
+            CheckBox        ExportDetectionsXML_CheckBox;
 
         SectionBar      Calibration_SectionBar;
         Control         Calibration_Control;
@@ -79,12 +90,19 @@ private:
         Control         Integration_Control;
         VerticalSizer   Integration_Sizer;
             CheckBox        EnableDigitalAO_CheckBox;
+            HorizontalSizer     DigitalAOModel_Sizer;
+                Label               DigitalAOModel_Label;
+                ComboBox            DigitalAOModel_ComboBox;
+            NumericControl      DigitalAOGridSpacing_NumericControl;
             NumericControl      StarSizeRejectionThreshold_NumericControl;
             NumericControl      StarMovementRejectionThreshold_NumericControl;
             HorizontalSizer     Interpolation_Sizer;
                 Label               Interpolation_Lable;
                 ComboBox            Interpolation_ComboBox;
             NumericControl      FramePercentage_NumericControl;
+            HorizontalSizer     SelectionMetric_Sizer;
+                Label               SelectionMetric_Label;
+                ComboBox            SelectionMetric_ComboBox;
             CheckBox            RegistrationOnly_CheckBox;
             HorizontalSizer     RegistrationOutputPath_Sizer;
                 Label               RegistrationOutputPath_Label;
@@ -107,10 +125,15 @@ private:
     void e_InputPath_Click(Button& sender, bool checked);
     void e_Calibration_Click(Button& sender, bool checked);
     void e_Calibration_EditCompleted(Edit& sender);
+    void e_StarDetection_Click(Button& sender, bool checked);
     void e_Integration_Click(Button& sender, bool checked);
     void e_RegistrationOutputPath_Click(Button& sender, bool checked);
     void __EditValueUpdated(NumericEdit& sender, double value);
     void __Interpolation_ItemSelected(ComboBox& /*sender*/, int itemIndex);
+    void __PSFModel_ItemSelected(ComboBox& /*sender*/, int itemIndex);
+    void __TrackingMode_ItemSelected(ComboBox& /*sender*/, int itemIndex);
+    void __DigitalAOModel_ItemSelected(ComboBox& /*sender*/, int itemIndex);
+    void __SelectionMetric_ItemSelected(ComboBox& /*sender*/, int itemIndex);
 
     friend struct GUIData;
 };
@@ -8,14 +8,24 @@ LIInputPath* TheLIInputPathParameter = nullptr;
 LIApproxFWHM* TheLIApproxFWHMParameter = nullptr;
 LIMinPeak* TheLIMinPeakParameter = nullptr;
 LISaturationThreshold* TheLISaturationThresholdParameter = nullptr;
+LIPSFModel* TheLIPSFModelParameter = nullptr;
+LITrackingMode* TheLITrackingModeParameter = nullptr;
+LIMotionPrediction* TheLIMotionPredictionParameter = nullptr;
+LITrackingWindow* TheLITrackingWindowParameter = nullptr;
+LIRedetectionInterval* TheLIRedetectionIntervalParameter = nullptr;
+LIRedetectionThreshold* TheLIRedetectionThresholdParameter = nullptr;
+LIExportDetectionsXML* TheLIExportDetectionsXMLParameter = nullptr;
 LIMasterDarkPath* TheLIMasterDarkPathParameter = nullptr;
 LIMasterFlatPath* TheLIMasterFlatPathParameter = nullptr;
 LIPedestal* TheLIPedestalParameter = nullptr;
 LIEnableDigitalAO* TheLIEnableDigitalAOParameter = nullptr;
+LIDigitalAOModel* TheLIDigitalAOModelParameter = nullptr;
+LIDigitalAOGridSpacing* TheLIDigitalAOGridSpacingParameter = nullptr;
 LIStarSizeRejectionThreshold* TheLIStarSizeRejectionThresholdParameter = nullptr;
 LIStarMovementRejectionThreshold* TheLIStarMovementRejectionThresholdParameter = nullptr;
 LIInterpolation* TheLIInterpolationParameter = nullptr;
 LIFramePercentage* TheLIFramePercentageParameter = nullptr;
+LISelectionMetric* TheLISelectionMetricParameter = nullptr;
 LIRegistrationOnly* TheLIRegistrationOnlyParameter = nullptr;
 LIRegistrationOutputPath* TheLIRegistrationOutputPathParameter = nullptr;
 
@@ -155,6 +165,197 @@ double LISaturationThreshold::DefaultValue() const
     return 0.85;
 }
 
+LIPSFModel::LIPSFModel(MetaProcess* P) : MetaEnumeration(P)
+{
+    TheLIPSFModelParameter = this;
+}
+
+IsoString LIPSFModel::Id() const
+{
+    return "psfModel";
+}
+
+size_type LIPSFModel::NumberOfElements() const
+{
+    return NumberOfPSFModels;
+}
+
+IsoString LIPSFModel::ElementId(size_type i) const
+{
+    switch (i)
+    {
+    default:
+    case Separable: return "Separable";
+    case Gaussian:  return "Gaussian";
+    case Moffat:    return "Moffat";
+    }
+}
+
+int LIPSFModel::ElementValue(size_type i) const
+{
+    return int(i);
+}
+
+size_type LIPSFModel::DefaultValueIndex() const
+{
+    return size_type(Default);
+}
+
+LITrackingMode::LITrackingMode(MetaProcess* P) : MetaEnumeration(P)
+{
+    TheLITrackingModeParameter = this;
+}
+
+IsoString LITrackingMode::Id() const
+{
+    return "trackingMode";
+}
+
+size_type LITrackingMode::NumberOfElements() const
+{
+    return NumberOfTrackingModes;
+}
+
+IsoString LITrackingMode::ElementId(size_type i) const
+{
+    switch (i)
+    {
+    default:
+    case Sequential:  return "Sequential";
+    case Independent: return "Independent";
+    }
+}
+
+int LITrackingMode::ElementValue(size_type i) const
+{
+    return int(i);
+}
+
+size_type LITrackingMode::DefaultValueIndex() const
+{
+    return size_type(Default);
+}
+
+LIMotionPrediction::LIMotionPrediction(MetaProcess* P) : MetaBoolean(P)
+{
+    TheLIMotionPredictionParameter = this;
+}
+
+IsoString LIMotionPrediction::Id() const
+{
+    return "motionPrediction";
+}
+
+bool LIMotionPrediction::DefaultValue() const
+{
+    return false;
+}
+
+LITrackingWindow::LITrackingWindow(MetaProcess* P) : MetaFloat(P)
+{
+    TheLITrackingWindowParameter = this;
+}
+
+IsoString LITrackingWindow::Id() const
+{
+    return "trackingWindow";
+}
+
+int LITrackingWindow::Precision() const
+{
+    return 2;
+}
+
+double LITrackingWindow::MinimumValue() const
+{
+    return 0.5;
+}
+
+double LITrackingWindow::MaximumValue() const
+{
+    return 8.0;
+}
+
+double LITrackingWindow::DefaultValue() const
+{
+    return 2.0;
+}
+
+LIRedetectionInterval::LIRedetectionInterval(MetaProcess* P) : MetaFloat(P)
+{
+    TheLIRedetectionIntervalParameter = this;
+}
+
+IsoString LIRedetectionInterval::Id() const
+{
+    return "redetectionInterval";
+}
+
+int LIRedetectionInterval::Precision() const
+{
+    return 0;
+}
+
+double LIRedetectionInterval::MinimumValue() const
+{
+    return 0.0;
+}
+
+double LIRedetectionInterval::MaximumValue() const
+{
+    return 10000.0;
+}
+
+double LIRedetectionInterval::DefaultValue() const
+{
+    return 50.0;
+}
+
+LIRedetectionThreshold::LIRedetectionThreshold(MetaProcess* P) : MetaFloat(P)
+{
+    TheLIRedetectionThresholdParameter = this;
+}
+
+IsoString LIRedetectionThreshold::Id() const
+{
+    return "redetectionThreshold";
+}
+
+int LIRedetectionThreshold::Precision() const
+{
+    return 0;
+}
+
+double LIRedetectionThreshold::MinimumValue() const
+{
+    return 0.0;
+}
+
+double LIRedetectionThreshold::MaximumValue() const
+{
+    return 100.0;
+}
+
+double LIRedetectionThreshold::DefaultValue() const
+{
+    return 80.0;
+}
+
+LIExportDetectionsXML::LIExportDetectionsXML(MetaProcess* P) : MetaBoolean(P)
+{
+    TheLIExportDetectionsXMLParameter = this;
+}
+
+IsoString LIExportDetectionsXML::Id() const
+{
+    return "exportDetectionsXML";
+}
+
+bool LIExportDetectionsXML::DefaultValue() const
+{
+    return false;
+}
+
 LIMasterDarkPath::LIMasterDarkPath(MetaProcess* P) : MetaString(P)
 {
     TheLIMasterDarkPathParameter = this;
@@ -220,6 +421,71 @@ bool LIEnableDigitalAO::DefaultValue() const
     return true;
 }
 
+LIDigitalAOModel::LIDigitalAOModel(MetaProcess* P) : MetaEnumeration(P)
+{
+    TheLIDigitalAOModelParameter = this;
+}
+
+IsoString LIDigitalAOModel::Id() const
+{
+    return "digitalAOModel";
+}
+
+size_type LIDigitalAOModel::NumberOfElements() const
+{
+    return NumberOfDigitalAOModels;
+}
+
+IsoString LIDigitalAOModel::ElementId(size_type i) const
+{
+    switch (i)
+    {
+    default:
+    case InverseDistance: return "InverseDistance";
+    case PiecewiseAffine: return "PiecewiseAffine";
+    }
+}
+
+int LIDigitalAOModel::ElementValue(size_type i) const
+{
+    return int(i);
+}
+
+size_type LIDigitalAOModel::DefaultValueIndex() const
+{
+    return size_type(Default);
+}
+
+LIDigitalAOGridSpacing::LIDigitalAOGridSpacing(MetaProcess* P) : MetaFloat(P)
+{
+    TheLIDigitalAOGridSpacingParameter = this;
+}
+
+IsoString LIDigitalAOGridSpacing::Id() const
+{
+    return "digitalAOGridSpacing";
+}
+
+int LIDigitalAOGridSpacing::Precision() const
+{
+    return 0;
+}
+
+double LIDigitalAOGridSpacing::MinimumValue() const
+{
+    return 4.0;
+}
+
+double LIDigitalAOGridSpacing::MaximumValue() const
+{
+    return 256.0;
+}
+
+double LIDigitalAOGridSpacing::DefaultValue() const
+{
+    return 16.0;
+}
+
 LIStarSizeRejectionThreshold::LIStarSizeRejectionThreshold(MetaProcess* P) : MetaFloat(P)
 {
     TheLIStarSizeRejectionThresholdParameter = this;
@@ -303,6 +569,8 @@ IsoString LIInterpolation::ElementId(size_type i) const
     case Nearest:   return "Nearest";
     case Bilinear:  return "Bilinear";
     case Lanczos3:  return "Lanczos3";
+    case Lanczos4:  return "Lanczos4";
+    case Lanczos5:  return "Lanczos5";
     }
 }
 
@@ -346,6 +614,42 @@ double LIFramePercentage::DefaultValue() const
     return 100.0;
 }
 
+LISelectionMetric::LISelectionMetric(MetaProcess* P) : MetaEnumeration(P)
+{
+    TheLISelectionMetricParameter = this;
+}
+
+IsoString LISelectionMetric::Id() const
+{
+    return "selectionMetric";
+}
+
+size_type LISelectionMetric::NumberOfElements() const
+{
+    return NumberOfSelectionMetrics;
+}
+
+IsoString LISelectionMetric::ElementId(size_type i) const
+{
+    switch (i)
+    {
+    default:
+    case Quality:  return "Quality";
+    case StarSize: return "StarSize";
+    case Jitter:   return "Jitter";
+    }
+}
+
+int LISelectionMetric::ElementValue(size_type i) const
+{
+    return int(i);
+}
+
+size_type LISelectionMetric::DefaultValueIndex() const
+{
+    return size_type(Default);
+}
+
 LIRegistrationOnly::LIRegistrationOnly(MetaProcess* P) : MetaBoolean(P)
 {
     TheLIRegistrationOnlyParameter = this;
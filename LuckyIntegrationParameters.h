@@ -82,6 +82,113 @@ public:
 
 extern LISaturationThreshold* TheLISaturationThresholdParameter;
 
+class LIPSFModel : public MetaEnumeration
+{
+public:
+    enum {
+        Separable,
+        Gaussian,
+        Moffat,
+        NumberOfPSFModels,
+        Default = Separable
+    };
+
+    LIPSFModel(MetaProcess*);
+
+    IsoString Id() const override;
+    size_type NumberOfElements() const override;
+    IsoString ElementId(size_type) const override;
+    int ElementValue(size_type) const override;
+    size_type DefaultValueIndex() const override;
+};
+
+extern LIPSFModel* TheLIPSFModelParameter;
+
+class LITrackingMode : public MetaEnumeration
+{
+public:
+    enum {
+        Sequential,
+        Independent,
+        NumberOfTrackingModes,
+        Default = Sequential
+    };
+
+    LITrackingMode(MetaProcess*);
+
+    IsoString Id() const override;
+    size_type NumberOfElements() const override;
+    IsoString ElementId(size_type) const override;
+    int ElementValue(size_type) const override;
+    size_type DefaultValueIndex() const override;
+};
+
+extern LITrackingMode* TheLITrackingModeParameter;
+
+class LIMotionPrediction : public MetaBoolean
+{
+public:
+    LIMotionPrediction(MetaProcess*);
+
+    IsoString Id() const override;
+    bool DefaultValue() const override;
+};
+
+extern LIMotionPrediction* TheLIMotionPredictionParameter;
+
+class LITrackingWindow : public MetaFloat
+{
+public:
+    LITrackingWindow(MetaProcess*);
+
+    IsoString Id() const override;
+    int Precision() const override;
+    double MinimumValue() const override;
+    double MaximumValue() const override;
+    double DefaultValue() const override;
+};
+
+extern LITrackingWindow* TheLITrackingWindowParameter;
+
+class LIRedetectionInterval : public MetaFloat
+{
+public:
+    LIRedetectionInterval(MetaProcess*);
+
+    IsoString Id() const override;
+    int Precision() const override;
+    double MinimumValue() const override;
+    double MaximumValue() const override;
+    double DefaultValue() const override;
+};
+
+extern LIRedetectionInterval* TheLIRedetectionIntervalParameter;
+
+class LIRedetectionThreshold : public MetaFloat
+{
+public:
+    LIRedetectionThreshold(MetaProcess*);
+
+    IsoString Id() const override;
+    int Precision() const override;
+    double MinimumValue() const override;
+    double MaximumValue() const override;
+    double DefaultValue() const override;
+};
+
+extern LIRedetectionThreshold* TheLIRedetectionThresholdParameter;
+
+class LIExportDetectionsXML : public MetaBoolean
+{
+public:
+    LIExportDetectionsXML(MetaProcess*);
+
+    IsoString Id() const override;
+    bool DefaultValue() const override;
+};
+
+extern LIExportDetectionsXML* TheLIExportDetectionsXMLParameter;
+
 class LIMasterDarkPath : public MetaString
 {
 public:
@@ -127,6 +234,41 @@ public:
 
 extern LIEnableDigitalAO* TheLIEnableDigitalAOParameter;
 
+class LIDigitalAOModel : public MetaEnumeration
+{
+public:
+    enum {
+        InverseDistance,
+        PiecewiseAffine,
+        NumberOfDigitalAOModels,
+        Default = InverseDistance
+    };
+
+    LIDigitalAOModel(MetaProcess*);
+
+    IsoString Id() const override;
+    size_type NumberOfElements() const override;
+    IsoString ElementId(size_type) const override;
+    int ElementValue(size_type) const override;
+    size_type DefaultValueIndex() const override;
+};
+
+extern LIDigitalAOModel* TheLIDigitalAOModelParameter;
+
+class LIDigitalAOGridSpacing : public MetaFloat
+{
+public:
+    LIDigitalAOGridSpacing(MetaProcess*);
+
+    IsoString Id() const override;
+    int Precision() const override;
+    double MinimumValue() const override;
+    double MaximumValue() const override;
+    double DefaultValue() const override;
+};
+
+extern LIDigitalAOGridSpacing* TheLIDigitalAOGridSpacingParameter;
+
 class LIStarSizeRejectionThreshold : public MetaFloat
 {
 public:
@@ -162,6 +304,8 @@ public:
         Nearest,
         Bilinear,
         Lanczos3,
+        Lanczos4,
+        Lanczos5,
         NumberOfInterpolations,
         Default = Bilinear
     };
@@ -191,6 +335,28 @@ public:
 
 extern LIFramePercentage* TheLIFramePercentageParameter;
 
+class LISelectionMetric : public MetaEnumeration
+{
+public:
+    enum {
+        Quality,
+        StarSize,
+        Jitter,
+        NumberOfSelectionMetrics,
+        Default = Quality
+    };
+
+    LISelectionMetric(MetaProcess*);
+
+    IsoString Id() const override;
+    size_type NumberOfElements() const override;
+    IsoString ElementId(size_type) const override;
+    int ElementValue(size_type) const override;
+    size_type DefaultValueIndex() const override;
+};
+
+extern LISelectionMetric* TheLISelectionMetricParameter;
+
 class LIRegistrationOnly : public MetaBoolean
 {
 public:
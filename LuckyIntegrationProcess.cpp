@@ -23,13 +23,23 @@ LuckyIntegrationProcess::LuckyIntegrationProcess()
     new LIApproxFWHM(this);
     new LIMinPeak(this);
     new LISaturationThreshold(this);
+    new LIPSFModel(this);
+    new LITrackingMode(this);
+    new LIMotionPrediction(this);
+    new LITrackingWindow(this);
+    new LIRedetectionInterval(this);
+    new LIRedetectionThreshold(this);
+    new LIExportDetectionsXML(this);
     new LIMasterDarkPath(this);
     new LIMasterFlatPath(this);
     new LIPedestal(this);
     new LIEnableDigitalAO(this);
+    new LIDigitalAOModel(this);
+    new LIDigitalAOGridSpacing(this);
     new LIStarSizeRejectionThreshold(this);
     new LIStarMovementRejectionThreshold(this);
     new LIFramePercentage(this);
+    new LISelectionMetric(this);
     new LIInterpolation(this);
     new LIRegistrationOnly(this);
     new LIRegistrationOutputPath(this);
@@ -0,0 +1,215 @@
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "NativeStarTable.h"
+
+// Per-frame registration and quality summary, computed once from the star
+// table at alignment time
+struct NativeFrameTransform
+{
+    float shiftX;               // mean offset of the live stars from the reference frame
+    float shiftY;
+    float jitter;               // mean movement of the live stars since the previous frame
+    float sizeX;                // mean star size
+    float sizeY;
+    float fwhm;                 // mean PSF FWHM
+    int32_t numLive;            // stars measured in the frame, -1 if the frame was never stored
+    float quality;              // live star fraction over mean star area; higher is sharper
+    uint32_t firstControl;      // digital AO control points of the frame
+    uint32_t numControls;
+};
+
+// Displacement of a star measured in a frame from its reference position
+struct NativeFrameControl
+{
+    int32_t star;
+    float dx;
+    float dy;
+};
+
+// Everything integration needs from the alignment: one transform record per
+// frame, the reference star positions and the displacements of the live stars
+// of each frame as digital AO control points. The stars live in the reference
+// frame are the controls of frame 0. The file is a header followed by the
+// transforms, the reference positions and the controls, in native byte order.
+class NativeFrameTable
+{
+public:
+    static constexpr uint32_t FileVersion = 1;
+
+    struct FileHeader
+    {
+        char magic[8];          // "LIFRAME" and a zero
+        uint32_t version;
+        uint32_t numFrames;
+        uint32_t numStars;
+        uint32_t numControls;
+    };
+
+private:
+    std::vector<NativeFrameTransform> m_transforms;
+    std::vector<NativeFrameControl> m_controls;
+    std::vector<float> m_referenceX;
+    std::vector<float> m_referenceY;
+
+public:
+    void clear()
+    {
+        m_transforms.clear();
+        m_controls.clear();
+        m_referenceX.clear();
+        m_referenceY.clear();
+    }
+
+    void build(const NativeStarTable& stars)
+    {
+        clear();
+        const int numStars = stars.numStars();
+        const int numFrames = stars.numFrames();
+        if (numFrames == 0)
+            return;
+        m_referenceX.assign(stars.row(0, NativeStarTable::X), stars.row(0, NativeStarTable::X) + numStars);
+        m_referenceY.assign(stars.row(0, NativeStarTable::Y), stars.row(0, NativeStarTable::Y) + numStars);
+        m_transforms.resize(numFrames);
+        std::vector<float> live(stars.stride());
+        for (int i = 0; i < numFrames; i++)
+        {
+            NativeFrameTransform& t = m_transforms[i];
+            t = NativeFrameTransform{};
+            t.firstControl = uint32_t(m_controls.size());
+            if (!stars.isStored(i))
+            {
+                t.numLive = -1;
+                continue;
+            }
+            t.numLive = stars.numValid(i);
+            if (t.numLive == 0)
+                continue;
+            stars.weights(i, live.data());
+            float n = float(t.numLive);
+            t.shiftX = stars.sumDifference(i, 0, NativeStarTable::X, live.data()) / n;
+            t.shiftY = stars.sumDifference(i, 0, NativeStarTable::Y, live.data()) / n;
+            if ((i > 0) && stars.isStored(i - 1))
+            {
+                float jx = stars.sumDifference(i, i - 1, NativeStarTable::X, live.data()) / n;
+                float jy = stars.sumDifference(i, i - 1, NativeStarTable::Y, live.data()) / n;
+                t.jitter = std::sqrt(jx * jx + jy * jy);
+            }
+            t.sizeX = stars.sum(i, NativeStarTable::SizeX, live.data()) / n;
+            t.sizeY = stars.sum(i, NativeStarTable::SizeY, live.data()) / n;
+            t.fwhm = stars.sum(i, NativeStarTable::Fwhm, live.data()) / n;
+            float area = t.sizeX * t.sizeY;
+            t.quality = (area > 0.0f) ? n / numStars / area : 0.0f;
+
+            const float* x = stars.row(i, NativeStarTable::X);
+            const float* y = stars.row(i, NativeStarTable::Y);
+            for (int j = 0; j < numStars; j++)
+                if (stars.isValid(i, j))
+                    m_controls.push_back({ j, x[j] - m_referenceX[j], y[j] - m_referenceY[j] });
+            t.numControls = uint32_t(m_controls.size()) - t.firstControl;
+        }
+    }
+
+    int numFrames() const
+    {
+        return int(m_transforms.size());
+    }
+
+    int numStars() const
+    {
+        return int(m_referenceX.size());
+    }
+
+    bool isEmpty() const
+    {
+        return m_transforms.empty();
+    }
+
+    bool isStored(int frame) const
+    {
+        return (frame < numFrames()) && (m_transforms[frame].numLive >= 0);
+    }
+
+    const NativeFrameTransform& transform(int frame) const
+    {
+        return m_transforms[frame];
+    }
+
+    const NativeFrameControl* controls(int frame) const
+    {
+        return m_controls.data() + m_transforms[frame].firstControl;
+    }
+
+    float referenceX(int star) const
+    {
+        return m_referenceX[star];
+    }
+
+    float referenceY(int star) const
+    {
+        return m_referenceY[star];
+    }
+
+    // Writes the table through a function write(const void* data, size_t size)
+    template<class W>
+    void write(W&& write) const
+    {
+        FileHeader header = {};
+        std::memcpy(header.magic, "LIFRAME", 8);
+        header.version = FileVersion;
+        header.numFrames = uint32_t(m_transforms.size());
+        header.numStars = uint32_t(m_referenceX.size());
+        header.numControls = uint32_t(m_controls.size());
+        write(&header, sizeof(FileHeader));
+        write(m_transforms.data(), m_transforms.size() * sizeof(NativeFrameTransform));
+        write(m_referenceX.data(), m_referenceX.size() * sizeof(float));
+        write(m_referenceY.data(), m_referenceY.size() * sizeof(float));
+        write(m_controls.data(), m_controls.size() * sizeof(NativeFrameControl));
+    }
+
+    // Reads a table written by write() from a file of fileSize bytes through
+    // a function read(void* data, size_t size). False if the contents are not
+    // a consistent frame table, leaving the table empty.
+    template<class R>
+    bool read(R&& read, uint64_t fileSize)
+    {
+        clear();
+        FileHeader header;
+        if (fileSize < sizeof(FileHeader))
+            return false;
+        read(&header, sizeof(FileHeader));
+        if ((std::memcmp(header.magic, "LIFRAME", 8) != 0) || (header.version != FileVersion))
+            return false;
+        uint64_t size = sizeof(FileHeader) + uint64_t(header.numFrames) * sizeof(NativeFrameTransform)
+                      + uint64_t(header.numStars) * 2 * sizeof(float) + uint64_t(header.numControls) * sizeof(NativeFrameControl);
+        if (size != fileSize)
+            return false;
+        m_transforms.resize(header.numFrames);
+        m_referenceX.resize(header.numStars);
+        m_referenceY.resize(header.numStars);
+        m_controls.resize(header.numControls);
+        read(m_transforms.data(), m_transforms.size() * sizeof(NativeFrameTransform));
+        read(m_referenceX.data(), m_referenceX.size() * sizeof(float));
+        read(m_referenceY.data(), m_referenceY.size() * sizeof(float));
+        read(m_controls.data(), m_controls.size() * sizeof(NativeFrameControl));
+        for (const NativeFrameTransform& t : m_transforms)
+            if ((uint64_t(t.firstControl) + t.numControls > header.numControls)
+                || ((t.numLive >= 0) && (uint32_t(t.numLive) != t.numControls)))
+            {
+                clear();
+                return false;
+            }
+        for (const NativeFrameControl& c : m_controls)
+            if ((c.star < 0) || (uint32_t(c.star) >= header.numStars))
+            {
+                clear();
+                return false;
+            }
+        return true;
+    }
+};
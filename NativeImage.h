@@ -1,12 +1,432 @@
 #pragma once
 
+#include <pcl/Exception.h>
+
+#include <new>
+#include <type_traits>
+#include <vector>
+
+#include "NativeImageKernels.h"
+
 template<typename T>
 class NativeImageData;
 
+enum class NativeSampleType
+{
+    UInt8,
+    UInt16,
+    UInt32,
+    Float
+};
+
+template<typename T>
+struct NativeSampleTraits;
+
+template<>
+struct NativeSampleTraits<uint8_t>
+{
+    static constexpr NativeSampleType type = NativeSampleType::UInt8;
+};
+
+template<>
+struct NativeSampleTraits<uint16_t>
+{
+    static constexpr NativeSampleType type = NativeSampleType::UInt16;
+};
+
+template<>
+struct NativeSampleTraits<uint32_t>
+{
+    static constexpr NativeSampleType type = NativeSampleType::UInt32;
+};
+
+template<>
+struct NativeSampleTraits<float>
+{
+    static constexpr NativeSampleType type = NativeSampleType::Float;
+};
+
+// Typed, non-virtual window on the pixels of a NativeImage. Rows are pitch
+// samples apart; use row() in hot loops to get a plain pointer per scanline.
+template<typename T>
+struct NativeImageView
+{
+    T* data;
+    int width;
+    int height;
+    int pitch;
+
+    T* row(int y) const
+    {
+        return data + size_t(y) * pitch;
+    }
+
+    T& operator()(int x, int y) const
+    {
+        return data[size_t(y) * pitch + x];
+    }
+
+    float get(int x, int y) const
+    {
+        return static_cast<float>(data[size_t(y) * pitch + x]);
+    }
+
+    float getNearest(float x, float y) const
+    {
+        int ix = int(x + 0.5f);
+        int iy = int(y + 0.5f);
+        if (ix < 0)
+            ix = 0;
+        else if (ix > width - 1)
+            ix = width - 1;
+        if (iy < 0)
+            iy = 0;
+        else if (iy > height - 1)
+            iy = height - 1;
+        return get(ix, iy);
+    }
+
+    float getBilinear(float x, float y) const
+    {
+        if (x < 1)
+            x = 1;
+        else if (x > width - 2)
+            x = width - 2;
+        if (y < 1)
+            y = 1;
+        else if (y > height - 2)
+            y = height - 2;
+        // Calculate the coordinates of the 4 nearest integer pixels
+        int x1 = int(x);
+        int y1 = int(y);
+        int x2 = x1 + 1;
+        int y2 = y1 + 1;
+        // Calculate the distances to the nearest pixels
+        float dx1 = x - x1;
+        float dy1 = y - y1;
+        float dx2 = x2 - x;
+        float dy2 = y2 - y;
+        float value = dx2 * dy2 * get(x1, y1) +
+                      dx1 * dy2 * get(x2, y1) +
+                      dx2 * dy1 * get(x1, y2) +
+                      dx1 * dy1 * get(x2, y2);
+
+        return value;
+    }
+
+    float getLanczos(float x, float y, int n) const
+    {
+        if (x < n)
+            x = n;
+        else if (x > width - n - 1)
+            x = width - n - 1;
+        if (y < n)
+            y = n;
+        else if (y > height - n - 1)
+            y = height - n - 1;
+
+        int x0 = int(x);
+        int y0 = int(y);
+
+        float sp = 0.0f;   // positive filter values
+        float sn = 0.0f;   // negative filter values
+        float wp = 0.0f;   // positive filter weight
+        float wn = 0.0f;   // negative filter weight
+
+        // Interpolation increments
+        float dx = x - x0;
+        float dy = y - y0;
+
+        // Precalculate horizontal filter values
+        float Lx[10];
+        for (int j = -n + 1, k = 0; j <= n; ++j, ++k)
+            Lx[k] = lanczos(j - dx, n);
+
+        for (int i = -n + 1; i <= n; ++i)
+            lanczosInterpolateRow(sp, sn, wp, wn, n, x0, y0 + i, Lx, lanczos(i - dy, n));
+
+        // Weighted convolution
+        return (sp - sn) / (wp - wn);
+    }
+
+    static float sinc(float x)
+    {
+        x *= 3.14159265358979f;
+        return (x > 1.0e-07f) ? sin(x) / x : 1.0f;
+    }
+
+    static float lanczos(float x, int n)
+    {
+        if (x < 0.0f)
+            x = -x;
+        if (x < n)
+            return sinc(x) * sinc(x / n);
+        return 0;
+    }
+
+private:
+    void lanczosInterpolateRow(float& sp, float& sn, float& wp, float& wn, int n, int x0, int y0, const float* Lx, float Ly) const
+    {
+        const T* r = row(y0);
+        int j, k;
+        for (j = -n + 1, k = 0; j <= n; ++j, ++k)
+        {
+            int x = x0 + j;
+            float L = Lx[k] * Ly;
+            float s = static_cast<float>(r[x]) * L;
+            if (s < 0)
+            {
+                sn -= s;
+                wn -= L;
+            }
+            else
+            {
+                sp += s;
+                wp += L;
+            }
+        }
+    }
+};
+
+// Element-wise binary operations between two sample buffers. Every
+// (destination, source) sample type pair gets its own fully specialized loop;
+// float by float is forwarded to the vectorized kernels.
+typedef void (*NativeBinaryKernel)(void* dst, const void* src, int n);
+
+struct NativeOpCopy
+{
+    static constexpr const char* name = "copy";
+    static constexpr bool integerDivision = false;
+
+    template<typename D, typename S>
+    static void apply(D& d, S s)
+    {
+        d = static_cast<D>(s);
+    }
+
+    static void vector(float* d, const float* s, int n)
+    {
+        CopyMemory(d, s, n * sizeof(float));
+    }
+};
+
+struct NativeOpAdd
+{
+    static constexpr const char* name = "add";
+    static constexpr bool integerDivision = false;
+
+    template<typename D, typename S>
+    static void apply(D& d, S s)
+    {
+        d = static_cast<D>(d + s);
+    }
+
+    static void vector(float* d, const float* s, int n)
+    {
+        NativeKernels::get().add(d, s, n);
+    }
+};
+
+struct NativeOpSub
+{
+    static constexpr const char* name = "sub";
+    static constexpr bool integerDivision = false;
+
+    template<typename D, typename S>
+    static void apply(D& d, S s)
+    {
+        d = static_cast<D>(d - s);
+    }
+
+    static void vector(float* d, const float* s, int n)
+    {
+        NativeKernels::get().sub(d, s, n);
+    }
+};
+
+struct NativeOpRSub
+{
+    static constexpr const char* name = "rsub";
+    static constexpr bool integerDivision = false;
+
+    template<typename D, typename S>
+    static void apply(D& d, S s)
+    {
+        d = static_cast<D>(s - d);
+    }
+
+    static void vector(float* d, const float* s, int n)
+    {
+        NativeKernels::get().rsub(d, s, n);
+    }
+};
+
+struct NativeOpMul
+{
+    static constexpr const char* name = "mul";
+    static constexpr bool integerDivision = false;
+
+    template<typename D, typename S>
+    static void apply(D& d, S s)
+    {
+        d = static_cast<D>(d * s);
+    }
+
+    static void vector(float* d, const float* s, int n)
+    {
+        NativeKernels::get().mul(d, s, n);
+    }
+};
+
+struct NativeOpDiv
+{
+    static constexpr const char* name = "div";
+    static constexpr bool integerDivision = true;
+
+    template<typename D, typename S>
+    static void apply(D& d, S s)
+    {
+        d = static_cast<D>(d / s);
+    }
+
+    static void vector(float* d, const float* s, int n)
+    {
+        NativeKernels::get().div(d, s, n);
+    }
+};
+
+template<typename Op, typename D, typename S>
+void nativeBinaryKernel(void* dst, const void* src, int n)
+{
+    D* d = static_cast<D*>(dst);
+    const S* s = static_cast<const S*>(src);
+    if constexpr (std::is_same<D, float>::value && std::is_same<S, float>::value)
+    {
+        Op::vector(d, s, n);
+    }
+    else if constexpr (std::is_same<Op, NativeOpCopy>::value && std::is_same<D, S>::value)
+    {
+        CopyMemory(d, s, n * sizeof(D));
+    }
+    else
+    {
+        for (int i = 0; i < n; i++)
+            Op::apply(d[i], s[i]);
+    }
+}
+
+// Integer by integer division is not provided: a zero divisor would trap.
+template<typename Op, typename D, typename S>
+constexpr NativeBinaryKernel nativeBinaryEntry()
+{
+    if constexpr (Op::integerDivision && std::is_integral<D>::value && std::is_integral<S>::value)
+        return nullptr;
+    else
+        return &nativeBinaryKernel<Op, D, S>;
+}
+
+#define NATIVE_BINARY_ROW(D)    \
+    { nativeBinaryEntry<Op, D, uint8_t>(), nativeBinaryEntry<Op, D, uint16_t>(), nativeBinaryEntry<Op, D, uint32_t>(), nativeBinaryEntry<Op, D, float>() }
+
+// Indexed by [destination type][source type], in NativeSampleType order.
+template<typename Op>
+struct NativeBinaryDispatch
+{
+    static constexpr NativeBinaryKernel table[4][4] = {
+        NATIVE_BINARY_ROW(uint8_t),
+        NATIVE_BINARY_ROW(uint16_t),
+        NATIVE_BINARY_ROW(uint32_t),
+        NATIVE_BINARY_ROW(float)
+    };
+
+    static NativeBinaryKernel kernel(NativeSampleType dst, NativeSampleType src)
+    {
+        return table[int(dst)][int(src)];
+    }
+};
+
+#undef NATIVE_BINARY_ROW
+
+// Size-keyed free list of 64-byte aligned sample buffers. Each worker thread
+// owns one pool, so frame-sized buffers are recycled instead of being
+// allocated, page-faulted and released for every frame. Not thread-safe.
+class NativeImagePool
+{
+private:
+    struct Block
+    {
+        void* ptr;
+        size_t bytes;
+    };
+
+    std::vector<Block> m_free;
+    size_t m_numAllocations = 0;
+    size_t m_numReuses = 0;
+
+public:
+    static constexpr size_t alignment = 64;
+
+    NativeImagePool() = default;
+    NativeImagePool(const NativeImagePool&) = delete;
+    NativeImagePool& operator=(const NativeImagePool&) = delete;
+
+    ~NativeImagePool()
+    {
+        for (const Block& b : m_free)
+            freeAligned(b.ptr);
+    }
+
+    static void* allocateAligned(size_t bytes)
+    {
+        return ::operator new(bytes, std::align_val_t(alignment));
+    }
+
+    static void freeAligned(void* p)
+    {
+        ::operator delete(p, std::align_val_t(alignment));
+    }
+
+    void* acquire(size_t bytes)
+    {
+        for (size_t i = 0; i < m_free.size(); i++)
+            if (m_free[i].bytes == bytes)
+            {
+                void* p = m_free[i].ptr;
+                m_free[i] = m_free.back();
+                m_free.pop_back();
+                m_numReuses++;
+                return p;
+            }
+        m_numAllocations++;
+        return allocateAligned(bytes);
+    }
+
+    void release(void* p, size_t bytes)
+    {
+        m_free.push_back(Block{ p, bytes });
+    }
+
+    // Buffers that had to be allocated from the heap
+    size_t numAllocations() const
+    {
+        return m_numAllocations;
+    }
+
+    // Allocations avoided by handing out a recycled buffer
+    size_t numReuses() const
+    {
+        return m_numReuses;
+    }
+};
+
 class NativeImageDataBase
 {
 protected:
-    NativeImageDataBase() {}
+    NativeImageDataBase(NativeSampleType type)
+        : m_type(type)
+    {
+    }
+
     virtual ~NativeImageDataBase() {};
     virtual void* data() = 0;
     virtual const void* data() const = 0;
@@ -25,6 +445,7 @@ protected:
     virtual void divConst(float c) = 0;
     virtual void clip() = 0;
 
+    NativeSampleType m_type;
     int m_numPixels = 0;
 
     friend class NativeImageData<uint8_t>;
@@ -40,17 +461,39 @@ class NativeImageData : public NativeImageDataBase
 private:
     T* m_data;
     int m_pitch;
+    NativeImagePool* m_pool;
 
-    explicit NativeImageData(int n, int pitch)
-        : m_data(new T[n])
+    explicit NativeImageData(int n, int pitch, NativeImagePool* pool)
+        : NativeImageDataBase(NativeSampleTraits<T>::type)
+        , m_data(nullptr)
         , m_pitch(pitch)
+        , m_pool(pool)
     {
+        m_data = allocateSamples(n);
         m_numPixels = n;
     }
 
     virtual ~NativeImageData()
     {
-        delete[] m_data;
+        freeSamples();
+    }
+
+    T* allocateSamples(int n)
+    {
+        size_t bytes = size_t(n) * sizeof(T);
+        void* p = m_pool ? m_pool->acquire(bytes) : NativeImagePool::allocateAligned(bytes);
+        return static_cast<T*>(p);
+    }
+
+    void freeSamples()
+    {
+        if (m_data == nullptr)
+            return;
+        if (m_pool)
+            m_pool->release(m_data, size_t(m_numPixels) * sizeof(T));
+        else
+            NativeImagePool::freeAligned(m_data);
+        m_data = nullptr;
     }
 
     void* data() override
@@ -84,130 +527,93 @@ private:
         m_data[y * m_pitch + x] += static_cast<T>(v);
     }
 
-#define COPY_IF_TYPE_IS(datatype)   \
-    if (dynamic_cast<const NativeImageData<datatype>*>(src))  \
-    {   \
-        for (int i = 0; i < m_numPixels; i++)   \
-            m_data[i] = dynamic_cast<const NativeImageData<datatype>*>(src)->m_data[i];   \
-        return; \
+    template<typename Op>
+    void binary(const NativeImageDataBase* src)
+    {
+        if (src->m_numPixels < m_numPixels)
+            throw pcl::Error(pcl::String("NativeImage: source image too small for ") + Op::name + ".");
+        NativeBinaryKernel kernel = NativeBinaryDispatch<Op>::kernel(m_type, src->m_type);
+        if (kernel == nullptr)
+            throw pcl::Error(pcl::String("NativeImage: unsupported sample types for ") + Op::name + ".");
+        kernel(m_data, src->data(), m_numPixels);
     }
 
     void copy(const NativeImageDataBase* src) override
     {
-        delete[] m_data;
-        m_data = new T[src->m_numPixels];
-        m_numPixels = src->m_numPixels;
-        if (dynamic_cast<const NativeImageData<T>*>(src))
+        if (m_numPixels != src->m_numPixels)
         {
-            CopyMemory(m_data, dynamic_cast<const NativeImageData<T>*>(src)->m_data, m_numPixels * sizeof(T));
-            return;
+            freeSamples();
+            m_data = allocateSamples(src->m_numPixels);
+            m_numPixels = src->m_numPixels;
         }
-        COPY_IF_TYPE_IS(uint8_t);
-        COPY_IF_TYPE_IS(uint16_t);
-        COPY_IF_TYPE_IS(uint32_t);
-        COPY_IF_TYPE_IS(float);
-    }
-
-#define ADD_IF_TYPE_IS(datatype)    \
-    if (dynamic_cast<const NativeImageData<datatype>*>(src))  \
-    {   \
-        for (int i = 0; i < m_numPixels; i++)   \
-            m_data[i] += dynamic_cast<const NativeImageData<datatype>*>(src)->m_data[i];   \
-        return; \
+        binary<NativeOpCopy>(src);
     }
 
     void add(const NativeImageDataBase* src) override
     {
-        ADD_IF_TYPE_IS(uint8_t);
-        ADD_IF_TYPE_IS(uint16_t);
-        ADD_IF_TYPE_IS(uint32_t);
-        ADD_IF_TYPE_IS(float);
+        binary<NativeOpAdd>(src);
     }
 
     void addConst(float c) override
     {
+        if constexpr (std::is_same<T, float>::value)
+        {
+            NativeKernels::get().addConst(m_data, c, m_numPixels);
+            return;
+        }
         for (int i = 0; i < m_numPixels; i++)
             m_data[i] += c;
     }
 
-#define SUB_IF_TYPE_IS(datatype)    \
-    if (dynamic_cast<const NativeImageData<datatype>*>(src))  \
-    {   \
-        for (int i = 0; i < m_numPixels; i++)   \
-            m_data[i] -= dynamic_cast<const NativeImageData<datatype>*>(src)->m_data[i];   \
-        return; \
-    }
-
     void sub(const NativeImageDataBase* src) override
     {
-        SUB_IF_TYPE_IS(uint8_t);
-        SUB_IF_TYPE_IS(uint16_t);
-        SUB_IF_TYPE_IS(uint32_t);
-        SUB_IF_TYPE_IS(float);
-    }
-
-#define RSUB_IF_TYPE_IS(datatype)    \
-    if (dynamic_cast<const NativeImageData<datatype>*>(src))  \
-    {   \
-        for (int i = 0; i < m_numPixels; i++)   \
-            m_data[i] = dynamic_cast<const NativeImageData<datatype>*>(src)->m_data[i] - m_data[i]; \
-        return; \
+        binary<NativeOpSub>(src);
     }
 
     void rsub(const NativeImageDataBase* src) override
     {
-        RSUB_IF_TYPE_IS(uint8_t);
-        RSUB_IF_TYPE_IS(uint16_t);
-        RSUB_IF_TYPE_IS(uint32_t);
-        RSUB_IF_TYPE_IS(float);
-    }
-
-#define MUL_IF_TYPE_IS(datatype)    \
-    if (dynamic_cast<const NativeImageData<datatype>*>(src))  \
-    {   \
-        for (int i = 0; i < m_numPixels; i++)   \
-            m_data[i] *= dynamic_cast<const NativeImageData<datatype>*>(src)->m_data[i];   \
-        return; \
+        binary<NativeOpRSub>(src);
     }
 
     void mul(const NativeImageDataBase* src) override
     {
-        MUL_IF_TYPE_IS(uint8_t);
-        MUL_IF_TYPE_IS(uint16_t);
-        MUL_IF_TYPE_IS(uint32_t);
-        MUL_IF_TYPE_IS(float);
+        binary<NativeOpMul>(src);
     }
 
     void mulConst(float c) override
     {
+        if constexpr (std::is_same<T, float>::value)
+        {
+            NativeKernels::get().mulConst(m_data, c, m_numPixels);
+            return;
+        }
         for (int i = 0; i < m_numPixels; i++)
             m_data[i] *= c;
     }
 
-#define DIV_IF_TYPE_IS(datatype)    \
-    if (dynamic_cast<const NativeImageData<datatype>*>(src))  \
-    {   \
-        for (int i = 0; i < m_numPixels; i++)   \
-            m_data[i] /= dynamic_cast<const NativeImageData<datatype>*>(src)->m_data[i];   \
-        return; \
-    }
-
     void div(const NativeImageDataBase* src) override
     {
-        DIV_IF_TYPE_IS(uint8_t);
-        DIV_IF_TYPE_IS(uint16_t);
-        DIV_IF_TYPE_IS(uint32_t);
-        DIV_IF_TYPE_IS(float);
+        binary<NativeOpDiv>(src);
     }
 
     void divConst(float c) override
     {
+        if constexpr (std::is_same<T, float>::value)
+        {
+            NativeKernels::get().divConst(m_data, c, m_numPixels);
+            return;
+        }
         for (int i = 0; i < m_numPixels; i++)
             m_data[i] /= c;
     }
 
     void clip() override
     {
+        if constexpr (std::is_same<T, float>::value)
+        {
+            NativeKernels::get().clip(m_data, m_numPixels);
+            return;
+        }
         for (int i = 0; i < m_numPixels; i++)
         {
             auto v = m_data[i];
@@ -229,50 +635,25 @@ class NativeImage
 {
 private:
     NativeImageDataBase* m_image;
+    NativeImagePool* m_pool;
     int m_width;
     int m_height;
     int m_depth;
     int m_size;
 
-    static float sinc(float x)
-    {
-        x *= 3.14159265358979f;
-        return (x > 1.0e-07f) ? sin(x) / x : 1.0f;
-    }
-
-    static float lanczos(float x, int n)
-    {
-        if (x < 0.0f)
-            x = -x;
-        if (x < n)
-            return sinc(x) * sinc(x / n);
-        return 0;
-    }
-
-    void lanczosInterpolateRow(float& sp, float& sn, float& wp, float& wn, int n, int x0, int y0, float* Lx, float Ly) const
+    template<typename T>
+    void checkType() const
     {
-        int j, k;
-        for (j = -n + 1, k = 0; j <= n; ++j, ++k)
-        {
-            int x = x0 + j;
-            float L = Lx[k] * Ly;
-            float s = m_image->get(x, y0) * L;
-            if (s < 0)
-            {
-                sn -= s;
-                wn -= L;
-            }
-            else
-            {
-                sp += s;
-                wp += L;
-            }
-        }
+        if ((m_image == nullptr) || (m_image->m_type != NativeSampleTraits<T>::type))
+            throw pcl::Error("NativeImage: sample type mismatch.");
     }
 
 public:
-    NativeImage()
+    // Images given a pool draw their buffers from it and hand them back when
+    // reallocated or destroyed; the pool must outlive the image.
+    explicit NativeImage(NativeImagePool* pool = nullptr)
         : m_image(nullptr)
+        , m_pool(pool)
         , m_width(0)
         , m_height(0)
         , m_depth(0)
@@ -309,11 +690,21 @@ public:
     template<typename T>
     void allocate(int w, int h, int sz = 0)
     {
-        if (m_image)
-            delete m_image;
         if (sz == 0)
             sz = w * h * sizeof(T);
-        m_image = new NativeImageData<T>(sz / sizeof(T), w);
+        int n = sz / sizeof(T);
+        if (m_image && (m_image->m_type == NativeSampleTraits<T>::type) && (m_image->m_numPixels == n))
+        {
+            // Same buffer size: keep the existing samples storage
+            static_cast<NativeImageData<T>*>(m_image)->m_pitch = w;
+        }
+        else
+        {
+            if (m_image)
+                delete m_image;
+            m_image = nullptr;
+            m_image = new NativeImageData<T>(n, w, m_pool);
+        }
         m_width = w;
         m_height = h;
         m_depth = sizeof(T) * 8;
@@ -325,6 +716,34 @@ public:
         return (m_image != nullptr);
     }
 
+    template<typename T>
+    NativeImageView<T> view()
+    {
+        checkType<T>();
+        return NativeImageView<T>{ static_cast<T*>(m_image->data()), m_width, m_height, m_width };
+    }
+
+    template<typename T>
+    NativeImageView<const T> view() const
+    {
+        checkType<T>();
+        return NativeImageView<const T>{ static_cast<const T*>(m_image->data()), m_width, m_height, m_width };
+    }
+
+    // Calls f with a const view of the matching sample type.
+    template<typename F>
+    auto visit(F&& f) const
+    {
+        switch (m_image->m_type)
+        {
+        case NativeSampleType::UInt8:   return f(view<uint8_t>());
+        case NativeSampleType::UInt16:  return f(view<uint16_t>());
+        case NativeSampleType::UInt32:  return f(view<uint32_t>());
+        default:
+        case NativeSampleType::Float:   return f(view<float>());
+        }
+    }
+
     float get(int x, int y) const
     {
         return m_image->get(x, y);
@@ -342,73 +761,17 @@ public:
 
     float getNearest(float x, float y) const
     {
-        return m_image->get(int(x + 0.5f), int(y + 0.5f));
+        return visit([=](const auto& v) { return v.getNearest(x, y); });
     }
 
     float getBilinear(float x, float y) const
     {
-        if (x < 1)
-            x = 1;
-        else if (x > m_width - 2)
-            x = m_width - 2;
-        if (y < 1)
-            y = 1;
-        else if (y > m_height - 2)
-            x = m_height - 2;
-        // Calculate the coordinates of the 4 nearest integer pixels
-        int x1 = int(x);
-        int y1 = int(y);
-        int x2 = x1 + 1;
-        int y2 = y1 + 1;
-        // Calculate the distances to the nearest pixels
-        float dx1 = x - x1;
-        float dy1 = y - y1;
-        float dx2 = x2 - x;
-        float dy2 = y2 - y;
-        float value = dx2 * dy2 * m_image->get(x1, y1) +
-                      dx1 * dy2 * m_image->get(x2, y1) +
-                      dx2 * dy1 * m_image->get(x1, y2) +
-                      dx1 * dy1 * m_image->get(x2, y2);
-
-        return value;
+        return visit([=](const auto& v) { return v.getBilinear(x, y); });
     }
 
     float getLanczos(float x, float y, int n) const
     {
-        if (x < n)
-            x = n;
-        else if (x > m_width - n - 1)
-            x = m_width - n - 1;
-        if (y < n)
-            y = n;
-        else if (y > m_height - n - 1)
-            x = m_height - n - 1;
-
-        int x0 = int(x);
-        int y0 = int(y);
-
-        float sp = 0.0f;   // positive filter values
-        float sn = 0.0f;   // negative filter values
-        float wp = 0.0f;   // positive filter weight
-        float wn = 0.0f;   // negative filter weight
-
-        // Interpolation increments
-        float dx = x - x0;
-        float dy = y - y0;
-
-        // Precalculate horizontal filter values
-        float Lx[10];
-        for (int j = -n + 1, k = 0; j <= n; ++j, ++k)
-            Lx[k] = lanczos(j - dx, n);
-
-        for (int i = -n + 1; i <= n; ++i)
-        {
-            int y = y0 + i;
-            lanczosInterpolateRow(sp, sn, wp, wn, n, x0, y0, Lx, lanczos(i - dy, n));
-        }
-
-        // Weighted convolution
-        return (sp - sn) / (wp - wn);
+        return visit([=](const auto& v) { return v.getLanczos(x, y, n); });
     }
 
     void zero()
@@ -430,6 +793,34 @@ public:
         m_image->copy(srcImage.m_image);
     }
 
+    // Single-pass frame calibration: this = (src - dark + pedestal) * flatScale,
+    // with flatScale = flatMean / flat precomputed once per run. Pass nullptr for
+    // a missing master; the pedestal only applies together with a dark. All
+    // images must be float and already allocated with the same geometry.
+    void calibrate(const NativeImage& srcImage, const NativeImage* dark, float pedestal, const NativeImage* flatScale)
+    {
+        auto dst = view<float>();
+        auto src = srcImage.view<float>();
+        int n = m_width * m_height;
+        if ((srcImage.m_width != m_width) || (srcImage.m_height != m_height))
+            throw pcl::Error("NativeImage: calibration frame geometry mismatch.");
+        const float* darkData = nullptr;
+        if (dark != nullptr)
+        {
+            if ((dark->m_width != m_width) || (dark->m_height != m_height))
+                throw pcl::Error("NativeImage: master dark geometry mismatch.");
+            darkData = dark->view<float>().data;
+        }
+        const float* flatData = nullptr;
+        if (flatScale != nullptr)
+        {
+            if ((flatScale->m_width != m_width) || (flatScale->m_height != m_height))
+                throw pcl::Error("NativeImage: master flat geometry mismatch.");
+            flatData = flatScale->view<float>().data;
+        }
+        NativeKernels::get().calibrate(dst.data, src.data, darkData, pedestal, flatData, n);
+    }
+
     void add(const NativeImage& srcImage)
     {
         m_image->add(srcImage.m_image);
@@ -0,0 +1,917 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include "NativeImage.h"
+
+// Summed-area tables of a float image: running sums of the sample values
+// (optionally of their squares) and of the number of valid samples, with NaN
+// pixels excluded from both. Any axis-aligned box sum, count, mean or
+// variance is then four lookups, independent of the box size. Sums are kept in
+// double precision so that large frames do not lose the low-order bits.
+class NativeIntegralImage
+{
+private:
+    int m_width = 0;
+    int m_height = 0;
+    std::vector<double> m_sum;          // (width + 1) x (height + 1), zero first row and column
+    std::vector<double> m_sum2;         // empty unless built with squares
+    std::vector<int32_t> m_count;
+
+    size_t index(int x, int y) const
+    {
+        return size_t(y) * (m_width + 1) + x;
+    }
+
+    template<typename T>
+    T boxTotal(const std::vector<T>& table, int x0, int y0, int x1, int y1) const
+    {
+        return table[index(x1, y1)] - table[index(x0, y1)] - table[index(x1, y0)] + table[index(x0, y0)];
+    }
+
+    // Clamp the inclusive box [x0, x1] x [y0, y1] to the image, as exclusive
+    // table coordinates
+    bool clip(int& x0, int& y0, int& x1, int& y1) const
+    {
+        x0 = std::max(x0, 0);
+        y0 = std::max(y0, 0);
+        x1 = std::min(x1, m_width - 1) + 1;
+        y1 = std::min(y1, m_height - 1) + 1;
+        return (x0 < x1) && (y0 < y1);
+    }
+
+public:
+    void build(const NativeImageView<const float>& src, bool squares = false)
+    {
+        m_width = src.width;
+        m_height = src.height;
+        size_t n = size_t(m_width + 1) * (m_height + 1);
+        m_sum.assign(n, 0.0);
+        m_count.assign(n, 0);
+        if (squares)
+            m_sum2.assign(n, 0.0);
+        else
+            m_sum2.clear();
+        for (int y = 0; y < m_height; y++)
+        {
+            const float* r = src.row(y);
+            double rowSum = 0.0, rowSum2 = 0.0;
+            int32_t rowCount = 0;
+            for (int x = 0; x < m_width; x++)
+            {
+                float v = r[x];
+                if (!std::isnan(v))
+                {
+                    rowSum += v;
+                    rowSum2 += double(v) * v;
+                    rowCount++;
+                }
+                size_t i = index(x + 1, y + 1);
+                size_t above = index(x + 1, y);
+                m_sum[i] = m_sum[above] + rowSum;
+                m_count[i] = m_count[above] + rowCount;
+                if (squares)
+                    m_sum2[i] = m_sum2[above] + rowSum2;
+            }
+        }
+    }
+
+    int width() const
+    {
+        return m_width;
+    }
+
+    int height() const
+    {
+        return m_height;
+    }
+
+    // Statistics of the valid pixels in the inclusive box [x0, x1] x [y0, y1],
+    // clipped to the image
+    int boxCount(int x0, int y0, int x1, int y1) const
+    {
+        if (!clip(x0, y0, x1, y1))
+            return 0;
+        return boxTotal(m_count, x0, y0, x1, y1);
+    }
+
+    double boxSum(int x0, int y0, int x1, int y1) const
+    {
+        if (!clip(x0, y0, x1, y1))
+            return 0.0;
+        return boxTotal(m_sum, x0, y0, x1, y1);
+    }
+
+    // NaN if the box holds no valid pixel
+    float boxMean(int x0, int y0, int x1, int y1) const
+    {
+        if (!clip(x0, y0, x1, y1))
+            return std::nanf("");
+        int n = boxTotal(m_count, x0, y0, x1, y1);
+        return (n > 0) ? float(boxTotal(m_sum, x0, y0, x1, y1) / n) : std::nanf("");
+    }
+
+    // Population variance; requires a table built with squares
+    float boxVariance(int x0, int y0, int x1, int y1) const
+    {
+        if (!clip(x0, y0, x1, y1))
+            return std::nanf("");
+        int n = boxTotal(m_count, x0, y0, x1, y1);
+        if (n == 0)
+            return std::nanf("");
+        double mean = boxTotal(m_sum, x0, y0, x1, y1) / n;
+        return float(std::max(0.0, boxTotal(m_sum2, x0, y0, x1, y1) / n - mean * mean));
+    }
+
+    // dst(x, y) = mean of the valid pixels within `radius` of (x, y), for
+    // table rows y0 to y1 - 1 (all rows by default)
+    void boxMean(const NativeImageView<float>& dst, int radius, int y0 = 0, int y1 = -1) const
+    {
+        if (y1 < 0)
+            y1 = m_height;
+        for (int y = y0; y < y1; y++)
+        {
+            float* r = dst.row(y);
+            for (int x = 0; x < m_width; x++)
+                r[x] = boxMean(x - radius, y - radius, x + radius, y + radius);
+        }
+    }
+};
+
+// 3x3 cosmetic correction: pixels further than 2 sigma from the mean of their
+// 3x3 neighbourhood are replaced by the neighbourhood median, or by NaN when
+// invalidating. Interior rows go through the vectorized kernel; the first and
+// last rows and columns, where the neighbourhood is truncated, take a scalar
+// path over the in-bounds neighbours only.
+class NativeCosmeticCorrection
+{
+private:
+    static float borderPixel(const NativeImageView<const float>& src, int x, int y, bool invalidate)
+    {
+        float vals[9];
+        int n = 0;
+        for (int dy = std::max(y - 1, 0); dy <= std::min(y + 1, src.height - 1); dy++)
+            for (int dx = std::max(x - 1, 0); dx <= std::min(x + 1, src.width - 1); dx++)
+                vals[n++] = src(dx, dy);
+        float sum = 0.0f;
+        for (int k = 0; k < n; k++)
+            sum += vals[k];
+        float mean = sum / n;
+        float sum2 = 0.0f;
+        for (int k = 0; k < n; k++)
+            sum2 += (vals[k] - mean) * (vals[k] - mean);
+        float var = sum2 / n;
+        float v = src(x, y);
+        float d = v - mean;
+        if (d * d <= 4.0f * var)
+            return v;
+        if (invalidate)
+            return std::nanf("");
+        std::sort(vals, vals + n);
+        return vals[n / 2];
+    }
+
+public:
+    // Rows y0 to y1 - 1 (all rows by default); distinct row ranges may be
+    // processed concurrently
+    static void apply(const NativeImageView<float>& dst, const NativeImageView<const float>& src, bool invalidate, int y0 = 0, int y1 = -1)
+    {
+        const NativeKernels& kernels = NativeKernels::get();
+        int w = src.width;
+        int h = src.height;
+        if (y1 < 0)
+            y1 = h;
+        for (int y = y0; y < y1; y++)
+        {
+            float* d = dst.row(y);
+            if ((y == 0) || (y == h - 1) || (w < 3))
+            {
+                for (int x = 0; x < w; x++)
+                    d[x] = borderPixel(src, x, y, invalidate);
+                continue;
+            }
+            d[0] = borderPixel(src, 0, y, invalidate);
+            kernels.cosmetic3x3(d + 1, src.row(y - 1) + 1, src.row(y) + 1, src.row(y + 1) + 1, w - 2, invalidate);
+            d[w - 1] = borderPixel(src, w - 1, y, invalidate);
+        }
+    }
+};
+
+// Two-pass union-find labeling of the 8-connected components of a binary
+// mask. The first pass assigns provisional labels from the already visited
+// neighbours (W, NW, N, NE) and records equivalences, always keeping the
+// smallest label as the root; the second pass resolves every pixel to its
+// root and accumulates the component statistics directly. Components are
+// numbered in raster order of their first pixel.
+//
+// The first pass can be split into row bands: begin() sets up the bands,
+// labelBand() may then run concurrently for distinct bands, and finish()
+// joins the components that cross band seams before collecting.
+class NativeComponentLabeling
+{
+public:
+    struct Component
+    {
+        int x0, y0, x1, y1;     // inclusive bounding box
+        int count;
+        double sumX;            // sums of the pixel coordinates
+        double sumY;
+    };
+
+    const std::vector<Component>& label(const NativeImageView<const uint8_t>& mask)
+    {
+        begin(mask, 1);
+        labelBand(0);
+        return finish();
+    }
+
+    void begin(const NativeImageView<const uint8_t>& mask, int numBands)
+    {
+        m_mask = mask;
+        m_labels.resize(size_t(mask.width) * mask.height);
+        numBands = std::max(1, std::min(numBands, mask.height));
+        m_bands.resize(numBands);
+        for (int k = 0; k < numBands; k++)
+        {
+            m_bands[k].y0 = int(int64_t(mask.height) * k / numBands);
+            m_bands[k].y1 = int(int64_t(mask.height) * (k + 1) / numBands);
+        }
+    }
+
+    int numBands() const
+    {
+        return int(m_bands.size());
+    }
+
+    // Provisional labels of one band, local to the band
+    void labelBand(int band)
+    {
+        Band& b = m_bands[band];
+        int w = m_mask.width;
+        b.parent.assign(1, 0);      // label 0 is the background
+        for (int y = b.y0; y < b.y1; y++)
+        {
+            const uint8_t* m = m_mask.row(y);
+            int32_t* l = &m_labels[size_t(y) * w];
+            const int32_t* above = (y > b.y0) ? l - w : nullptr;
+            for (int x = 0; x < w; x++)
+            {
+                l[x] = 0;
+                if (m[x] == 0)
+                    continue;
+                int32_t label = 0;
+                if (x > 0)
+                    label = merge(b.parent, label, l[x - 1]);
+                if (above)
+                {
+                    if (x > 0)
+                        label = merge(b.parent, label, above[x - 1]);
+                    label = merge(b.parent, label, above[x]);
+                    if (x < w - 1)
+                        label = merge(b.parent, label, above[x + 1]);
+                }
+                if (label == 0)
+                {
+                    label = int32_t(b.parent.size());
+                    b.parent.push_back(label);
+                }
+                l[x] = label;
+            }
+        }
+    }
+
+    const std::vector<Component>& finish()
+    {
+        int w = m_mask.width;
+        int h = m_mask.height;
+
+        // Concatenate the band label sets. Offsetting keeps every parent
+        // below its children, and bands follow each other in raster order.
+        int32_t total = 0;
+        for (Band& b : m_bands)
+        {
+            b.offset = total;
+            total += int32_t(b.parent.size()) - 1;
+        }
+        m_parent.resize(size_t(total) + 1);
+        m_parent[0] = 0;
+        for (const Band& b : m_bands)
+            for (size_t i = 1; i < b.parent.size(); i++)
+                m_parent[b.offset + i] = b.offset + b.parent[i];
+
+        // Seams: the first row of a band against the last row of the previous one
+        for (size_t k = 1; k < m_bands.size(); k++)
+        {
+            const Band& b = m_bands[k];
+            const Band& a = m_bands[k - 1];
+            if ((b.y0 == b.y1) || (a.y0 == a.y1))
+                continue;
+            const int32_t* l = &m_labels[size_t(b.y0) * w];
+            const int32_t* above = l - w;
+            for (int x = 0; x < w; x++)
+            {
+                if (l[x] == 0)
+                    continue;
+                int32_t label = b.offset + l[x];
+                for (int dx = std::max(x - 1, 0); dx <= std::min(x + 1, w - 1); dx++)
+                    if (above[dx] != 0)
+                        label = merge(m_parent, label, a.offset + above[dx]);
+            }
+        }
+
+        // Roots are the smallest label of their set and parents never exceed
+        // their children, so one ascending sweep numbers the components
+        m_component.assign(m_parent.size(), -1);
+        int numComponents = 0;
+        for (size_t i = 1; i < m_parent.size(); i++)
+        {
+            int32_t root = find(m_parent, int32_t(i));
+            m_component[i] = (root == int32_t(i)) ? numComponents++ : m_component[root];
+        }
+
+        m_components.assign(numComponents, Component{ w, h, -1, -1, 0, 0.0, 0.0 });
+        for (const Band& b : m_bands)
+            for (int y = b.y0; y < b.y1; y++)
+            {
+                const int32_t* l = &m_labels[size_t(y) * w];
+                for (int x = 0; x < w; x++)
+                {
+                    if (l[x] == 0)
+                        continue;
+                    Component& c = m_components[m_component[b.offset + l[x]]];
+                    c.x0 = std::min(c.x0, x);
+                    c.y0 = std::min(c.y0, y);
+                    c.x1 = std::max(c.x1, x);
+                    c.y1 = std::max(c.y1, y);
+                    c.count++;
+                    c.sumX += x;
+                    c.sumY += y;
+                }
+            }
+        return m_components;
+    }
+
+private:
+    struct Band
+    {
+        int y0 = 0, y1 = 0;
+        std::vector<int32_t> parent;
+        int32_t offset = 0;         // of the band labels in the joined set
+    };
+
+    NativeImageView<const uint8_t> m_mask = { nullptr, 0, 0, 0 };
+    std::vector<Band> m_bands;
+    std::vector<int32_t> m_labels;
+    std::vector<int32_t> m_parent;
+    std::vector<int32_t> m_component;   // component index of each label
+    std::vector<Component> m_components;
+
+    static int32_t find(std::vector<int32_t>& parent, int32_t i)
+    {
+        while (parent[i] != i)
+        {
+            parent[i] = parent[parent[i]];  // path halving
+            i = parent[i];
+        }
+        return i;
+    }
+
+    // Union of the sets of a and b (either may be 0 = none); returns the root
+    static int32_t merge(std::vector<int32_t>& parent, int32_t a, int32_t b)
+    {
+        if (b == 0)
+            return a;
+        b = find(parent, b);
+        if (a == 0)
+            return b;
+        a = find(parent, a);
+        if (a < b)
+        {
+            parent[b] = a;
+            return a;
+        }
+        parent[a] = b;
+        return b;
+    }
+};
+
+// Uniform grid over a set of 2D points (anything with x and y members) for
+// radius and nearest-neighbour queries. Points are bucketed by a counting
+// sort into square cells, so a query only visits the cells that can hold a
+// match; with the cell size close to the query radius, a radius query over
+// all points is O(N) instead of O(N^2).
+class NativePointGrid
+{
+private:
+    float m_cellSize = 1.0f;
+    float m_x0 = 0.0f;
+    float m_y0 = 0.0f;
+    int m_cellsX = 0;
+    int m_cellsY = 0;
+    std::vector<float> m_x;
+    std::vector<float> m_y;
+    std::vector<int> m_cellStart;       // cellsX * cellsY + 1 offsets into m_index
+    std::vector<int> m_index;           // point indices grouped by cell
+
+    int cellX(float x) const
+    {
+        return std::max(0, std::min(m_cellsX - 1, int((x - m_x0) / m_cellSize)));
+    }
+
+    int cellY(float y) const
+    {
+        return std::max(0, std::min(m_cellsY - 1, int((y - m_y0) / m_cellSize)));
+    }
+
+public:
+    template<class C>
+    void build(const C& points, float cellSize)
+    {
+        m_cellSize = std::max(cellSize, 1.0e-3f);
+        m_x.clear();
+        m_y.clear();
+        for (const auto& p : points)
+        {
+            m_x.push_back(p.x);
+            m_y.push_back(p.y);
+        }
+        int n = int(m_x.size());
+        float x1 = 0.0f, y1 = 0.0f;
+        m_x0 = m_y0 = 0.0f;
+        if (n > 0)
+        {
+            m_x0 = *std::min_element(m_x.begin(), m_x.end());
+            m_y0 = *std::min_element(m_y.begin(), m_y.end());
+            x1 = *std::max_element(m_x.begin(), m_x.end());
+            y1 = *std::max_element(m_y.begin(), m_y.end());
+        }
+        m_cellsX = int((x1 - m_x0) / m_cellSize) + 1;
+        m_cellsY = int((y1 - m_y0) / m_cellSize) + 1;
+        m_cellStart.assign(size_t(m_cellsX) * m_cellsY + 1, 0);
+        for (int i = 0; i < n; i++)
+            m_cellStart[size_t(cellY(m_y[i])) * m_cellsX + cellX(m_x[i]) + 1]++;
+        for (size_t c = 1; c < m_cellStart.size(); c++)
+            m_cellStart[c] += m_cellStart[c - 1];
+        m_index.resize(n);
+        std::vector<int> fill(m_cellStart.begin(), m_cellStart.end() - 1);
+        for (int i = 0; i < n; i++)
+            m_index[fill[size_t(cellY(m_y[i])) * m_cellsX + cellX(m_x[i])]++] = i;
+    }
+
+    int size() const
+    {
+        return int(m_x.size());
+    }
+
+    // Calls f(i) for every point i strictly closer than `radius` to (x, y)
+    template<typename F>
+    void forEachWithin(float x, float y, float radius, F f) const
+    {
+        if (m_x.empty())
+            return;
+        float r2 = radius * radius;
+        int cx0 = cellX(x - radius), cx1 = cellX(x + radius);
+        int cy0 = cellY(y - radius), cy1 = cellY(y + radius);
+        for (int cy = cy0; cy <= cy1; cy++)
+            for (int cx = cx0; cx <= cx1; cx++)
+            {
+                size_t c = size_t(cy) * m_cellsX + cx;
+                for (int k = m_cellStart[c]; k < m_cellStart[c + 1]; k++)
+                {
+                    int i = m_index[k];
+                    float dx = m_x[i] - x, dy = m_y[i] - y;
+                    if (dx * dx + dy * dy < r2)
+                        f(i);
+                }
+            }
+    }
+
+    // Indices of the (up to) k points closest to (x, y), nearest first.
+    // Searches rings of cells outwards until no unvisited cell can be closer
+    // than the k-th candidate.
+    void nearest(float x, float y, int k, std::vector<int>& result) const
+    {
+        result.clear();
+        if (m_x.empty() || (k <= 0))
+            return;
+        std::vector<std::pair<float, int>> candidates;
+        int cx = cellX(x), cy = cellY(y);
+        int maxRing = std::max({ cx, cy, m_cellsX - 1 - cx, m_cellsY - 1 - cy });
+        for (int ring = 0; ring <= maxRing; ring++)
+        {
+            for (int j = cy - ring; j <= cy + ring; j++)
+            {
+                if ((j < 0) || (j >= m_cellsY))
+                    continue;
+                bool edgeRow = (j == cy - ring) || (j == cy + ring);
+                for (int i = cx - ring; i <= cx + ring; i += edgeRow ? 1 : 2 * std::max(ring, 1))
+                {
+                    if ((i < 0) || (i >= m_cellsX))
+                        continue;
+                    size_t c = size_t(j) * m_cellsX + i;
+                    for (int q = m_cellStart[c]; q < m_cellStart[c + 1]; q++)
+                    {
+                        int p = m_index[q];
+                        float dx = m_x[p] - x, dy = m_y[p] - y;
+                        candidates.emplace_back(dx * dx + dy * dy, p);
+                    }
+                }
+            }
+            if (int(candidates.size()) >= k)
+            {
+                std::nth_element(candidates.begin(), candidates.begin() + (k - 1), candidates.end());
+                // Any point in a cell beyond this ring is at least ring cells
+                // away from the query's own cell
+                float reach = ring * m_cellSize;
+                if (candidates[k - 1].first <= reach * reach)
+                    break;
+            }
+        }
+        int m = std::min(k, int(candidates.size()));
+        std::partial_sort(candidates.begin(), candidates.begin() + m, candidates.end());
+        for (int i = 0; i < m; i++)
+            result.push_back(candidates[i].second);
+    }
+};
+
+// Gaussian fitted to a sampled 1D profile, f(x) = background + amplitude *
+// exp(-(x - center)^2 / (2 sigma^2)), with x in sample units.
+struct NativeGaussianProfile
+{
+    float amplitude = 0.0f;
+    float background = 0.0f;
+    float center = 0.0f;
+    float sigma = 0.0f;
+    int iterations = 0;
+    bool converged = false;
+
+    float fwhm() const
+    {
+        return sigma * 2.35482f;
+    }
+};
+
+// Least-squares 1D Gaussian fit. The first guess is closed form: the
+// parabola through the logarithms of the three samples around the maximum
+// (a Gaussian is a parabola in log space), falling back to the second moment
+// when those samples do not allow it. A few Levenberg-Marquardt iterations on
+// all four parameters then refine it, so each profile costs on the order of
+// ten exp() evaluations per sample. The 4x4 normal equations are solved
+// inline rather than through cminpack's lmder, which the module also links:
+// for a problem this small, its callback and workspace setup per profile
+// would cost more than the fit itself.
+class NativeGaussianFit
+{
+private:
+    static bool solve4(double a[4][4], double b[4], double x[4])
+    {
+        int p[4] = { 0, 1, 2, 3 };
+        for (int c = 0; c < 4; c++)
+        {
+            int best = c;
+            for (int r = c + 1; r < 4; r++)
+                if (std::abs(a[p[r]][c]) > std::abs(a[p[best]][c]))
+                    best = r;
+            std::swap(p[c], p[best]);
+            double d = a[p[c]][c];
+            if (!(std::abs(d) > 1.0e-300))
+                return false;
+            for (int r = c + 1; r < 4; r++)
+            {
+                double f = a[p[r]][c] / d;
+                for (int k = c; k < 4; k++)
+                    a[p[r]][k] -= f * a[p[c]][k];
+                b[p[r]] -= f * b[p[c]];
+            }
+        }
+        for (int c = 3; c >= 0; c--)
+        {
+            double s = b[p[c]];
+            for (int k = c + 1; k < 4; k++)
+                s -= a[p[c]][k] * x[k];
+            x[c] = s / a[p[c]][c];
+        }
+        return true;
+    }
+
+    static double cost(const float* v, int n, const double q[4])
+    {
+        double e = 0.0;
+        for (int i = 0; i < n; i++)
+        {
+            double d = i - q[2];
+            double r = v[i] - (q[1] + q[0] * std::exp(-d * d / (2.0 * q[3] * q[3])));
+            e += r * r;
+        }
+        return e;
+    }
+
+    static NativeGaussianProfile firstGuess(const float* v, int n)
+    {
+        NativeGaussianProfile g;
+        int p = int(std::max_element(v, v + n) - v);
+        g.background = std::min(v[0], v[n - 1]);
+        g.amplitude = v[p] - g.background;
+        g.center = float(p);
+        if ((p > 0) && (p < n - 1) && (v[p - 1] > g.background) && (v[p + 1] > g.background))
+        {
+            double l0 = std::log(double(v[p - 1]) - g.background);
+            double l1 = std::log(double(v[p]) - g.background);
+            double l2 = std::log(double(v[p + 1]) - g.background);
+            double d = l0 - 2.0 * l1 + l2;
+            if (d < 0.0)
+            {
+                double s2 = -1.0 / d;
+                g.sigma = float(std::sqrt(s2));
+                g.center = float(p + 0.5 * s2 * (l2 - l0));
+                g.amplitude = float(std::exp(l1 + 0.5 * (p - g.center) * (p - g.center) / s2));
+                if (std::abs(g.center - p) <= 1.0f)
+                    return g;
+                g.center = float(p);
+                g.amplitude = v[p] - g.background;
+            }
+        }
+        double w = 0.0, m = 0.0, m2 = 0.0;
+        for (int i = 0; i < n; i++)
+        {
+            double wi = std::max(0.0, double(v[i]) - g.background);
+            w += wi;
+            m += wi * i;
+            m2 += wi * i * i;
+        }
+        if (w > 0.0)
+        {
+            m /= w;
+            g.center = float(m);
+            g.sigma = float(std::sqrt(std::max(m2 / w - m * m, 0.0)));
+        }
+        return g;
+    }
+
+public:
+    static NativeGaussianProfile fit(const float* v, int n, int maxIterations = 20)
+    {
+        if (n <= 0)
+            return NativeGaussianProfile();
+        if (n < 5)
+            return firstGuess(v, n);
+        NativeGaussianProfile g = firstGuess(v, n);
+        if (!(g.sigma > 0.0f) || !(g.amplitude > 0.0f))
+            return g;
+
+        // Parameters: amplitude, background, center, sigma
+        double q[4] = { g.amplitude, g.background, g.center, g.sigma };
+        double e = cost(v, n, q);
+        double lambda = 1.0e-3;
+        for (g.iterations = 1; g.iterations <= maxIterations; g.iterations++)
+        {
+            double jtj[4][4] = {}, jtr[4] = {};
+            for (int i = 0; i < n; i++)
+            {
+                double d = i - q[2];
+                double s2 = q[3] * q[3];
+                double ex = std::exp(-d * d / (2.0 * s2));
+                double r = v[i] - (q[1] + q[0] * ex);
+                double j[4] = { ex, 1.0, q[0] * ex * d / s2, q[0] * ex * d * d / (s2 * q[3]) };
+                for (int a = 0; a < 4; a++)
+                {
+                    jtr[a] += j[a] * r;
+                    for (int b = a; b < 4; b++)
+                        jtj[a][b] += j[a] * j[b];
+                }
+            }
+            for (int a = 0; a < 4; a++)
+                for (int b = 0; b < a; b++)
+                    jtj[a][b] = jtj[b][a];
+
+            bool improved = false;
+            double step[4];
+            while (lambda < 1.0e+10)
+            {
+                double m[4][4], rhs[4];
+                for (int a = 0; a < 4; a++)
+                {
+                    for (int b = 0; b < 4; b++)
+                        m[a][b] = jtj[a][b];
+                    m[a][a] += lambda * std::max(jtj[a][a], 1.0e-12);
+                    rhs[a] = jtr[a];
+                }
+                if (solve4(m, rhs, step))
+                {
+                    double t[4] = { q[0] + step[0], q[1] + step[1], q[2] + step[2], std::abs(q[3] + step[3]) };
+                    // Keep the solution within the sampled window, where the
+                    // amplitude and background remain separable
+                    bool inside = (t[3] > 1.0e-3) && (t[3] < n) && (t[2] >= 0.0) && (t[2] <= n - 1);
+                    double et = inside ? cost(v, n, t) : e;
+                    if (et < e)
+                    {
+                        std::copy(t, t + 4, q);
+                        e = et;
+                        lambda = std::max(lambda * 0.1, 1.0e-9);
+                        improved = true;
+                        break;
+                    }
+                }
+                lambda *= 10.0;
+            }
+            if (!improved || (std::abs(step[3]) < 1.0e-4 * q[3] && std::abs(step[2]) < 1.0e-4))
+            {
+                g.converged = true;
+                break;
+            }
+        }
+        if (std::isfinite(q[3]) && (q[0] > 0.0))
+        {
+            g.amplitude = float(q[0]);
+            g.background = float(q[1]);
+            g.center = float(q[2]);
+            g.sigma = float(q[3]);
+        }
+        else
+            g.converged = false;
+        return g;
+    }
+};
+
+// Smooth background model on a coarse mesh. Each cell holds the sigma-clipped
+// median of its pixels, so stars and hot pixels inside a cell do not bias it;
+// cells left with too few samples are filled from their neighbours. The model
+// is evaluated on demand with bicubic (Catmull-Rom) interpolation between
+// cell centres, so callers that only need it at a few positions never pay
+// for a full-resolution image.
+//
+// begin() sizes the mesh, measure() may then run concurrently for distinct
+// ranges of cell rows, and finish() fills the gaps.
+class NativeBackgroundMesh
+{
+private:
+    int m_width = 0;
+    int m_height = 0;
+    int m_cellSize = 64;
+    int m_cellsX = 0;
+    int m_cellsY = 0;
+    std::vector<float> m_cells;         // cellsX x cellsY medians, NaN until measured
+
+    float node(int i, int j) const
+    {
+        i = std::max(0, std::min(m_cellsX - 1, i));
+        j = std::max(0, std::min(m_cellsY - 1, j));
+        return m_cells[size_t(j) * m_cellsX + i];
+    }
+
+    static void cubicWeights(float t, float w[4])
+    {
+        float t2 = t * t, t3 = t2 * t;
+        w[0] = 0.5f * (-t3 + 2.0f * t2 - t);
+        w[1] = 0.5f * (3.0f * t3 - 5.0f * t2 + 2.0f);
+        w[2] = 0.5f * (-3.0f * t3 + 4.0f * t2 + t);
+        w[3] = 0.5f * (t3 - t2);
+    }
+
+public:
+    static constexpr float ClipSigma = 3.0f;
+    static constexpr int MaxClipIterations = 5;
+
+    void begin(int width, int height, int cellSize)
+    {
+        m_width = width;
+        m_height = height;
+        m_cellSize = std::max(cellSize, 2);
+        m_cellsX = (width + m_cellSize - 1) / m_cellSize;
+        m_cellsY = (height + m_cellSize - 1) / m_cellSize;
+        m_cells.assign(size_t(m_cellsX) * m_cellsY, std::numeric_limits<float>::quiet_NaN());
+    }
+
+    int cellsX() const
+    {
+        return m_cellsX;
+    }
+
+    int cellsY() const
+    {
+        return m_cellsY;
+    }
+
+    bool isEmpty() const
+    {
+        return m_cells.empty();
+    }
+
+    // Measures cell rows [j0, j1)
+    void measure(const NativeImageView<const float>& src, int j0, int j1)
+    {
+        std::vector<float> values, deviations;
+        values.reserve(size_t(m_cellSize) * m_cellSize);
+        for (int j = j0; j < j1; j++)
+            for (int i = 0; i < m_cellsX; i++)
+            {
+                int x0 = i * m_cellSize, x1 = std::min(x0 + m_cellSize, m_width);
+                int y0 = j * m_cellSize, y1 = std::min(y0 + m_cellSize, m_height);
+                values.clear();
+                for (int y = y0; y < y1; y++)
+                {
+                    const float* row = src.row(y);
+                    for (int x = x0; x < x1; x++)
+                        if (!std::isnan(row[x]))
+                            values.push_back(row[x]);
+                }
+                // A cell that is mostly invalid or clipped away is left for finish()
+                size_t minCount = size_t(x1 - x0) * (y1 - y0) / 4;
+                float median = 0.0f;
+                for (int iteration = 0; iteration < MaxClipIterations; iteration++)
+                {
+                    if ((values.size() < minCount) || values.empty())
+                        break;
+                    auto mid = values.begin() + values.size() / 2;
+                    std::nth_element(values.begin(), mid, values.end());
+                    median = *mid;
+                    deviations.resize(values.size());
+                    for (size_t k = 0; k < values.size(); k++)
+                        deviations[k] = std::abs(values[k] - median);
+                    auto dmid = deviations.begin() + deviations.size() / 2;
+                    std::nth_element(deviations.begin(), dmid, deviations.end());
+                    float limit = ClipSigma * 1.4826f * *dmid;
+                    size_t n = values.size();
+                    values.erase(std::remove_if(values.begin(), values.end(), [=](float v) { return std::abs(v - median) > limit; }), values.end());
+                    if (values.size() == n)
+                        break;
+                }
+                if ((values.size() >= minCount) && !values.empty())
+                    m_cells[size_t(j) * m_cellsX + i] = median;
+            }
+    }
+
+    // Fills unmeasured cells with the mean of their measured neighbours,
+    // growing inwards until the mesh is complete. A frame without any valid
+    // cell gets a zero background.
+    void finish()
+    {
+        std::vector<float> next;
+        for (;;)
+        {
+            bool missing = false, filled = false;
+            next = m_cells;
+            for (int j = 0; j < m_cellsY; j++)
+                for (int i = 0; i < m_cellsX; i++)
+                {
+                    if (!std::isnan(m_cells[size_t(j) * m_cellsX + i]))
+                        continue;
+                    float sum = 0.0f;
+                    int count = 0;
+                    for (int dj = -1; dj <= 1; dj++)
+                        for (int di = -1; di <= 1; di++)
+                        {
+                            int ii = i + di, jj = j + dj;
+                            if ((ii < 0) || (ii >= m_cellsX) || (jj < 0) || (jj >= m_cellsY))
+                                continue;
+                            float v = m_cells[size_t(jj) * m_cellsX + ii];
+                            if (!std::isnan(v))
+                            {
+                                sum += v;
+                                count++;
+                            }
+                        }
+                    if (count > 0)
+                    {
+                        next[size_t(j) * m_cellsX + i] = sum / count;
+                        filled = true;
+                    }
+                    else
+                        missing = true;
+                }
+            m_cells.swap(next);
+            if (!missing)
+                break;
+            if (!filled)
+            {
+                std::fill(m_cells.begin(), m_cells.end(), 0.0f);
+                break;
+            }
+        }
+    }
+
+    float get(float x, float y) const
+    {
+        // Cell centres sit at (i + 0.5) * cellSize - 0.5 in pixel coordinates
+        float fx = (x + 0.5f) / m_cellSize - 0.5f;
+        float fy = (y + 0.5f) / m_cellSize - 0.5f;
+        int ix = int(std::floor(fx));
+        int iy = int(std::floor(fy));
+        float wx[4], wy[4];
+        cubicWeights(fx - ix, wx);
+        cubicWeights(fy - iy, wy);
+        float v = 0.0f;
+        for (int j = 0; j < 4; j++)
+        {
+            float r = 0.0f;
+            for (int i = 0; i < 4; i++)
+                r += wx[i] * node(ix - 1 + i, iy - 1 + j);
+            v += wy[j] * r;
+        }
+        return v;
+    }
+};
@@ -0,0 +1,476 @@
+#pragma once
+
+#include <cstdint>
+#include <limits>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define NATIVE_KERNELS_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+// MSVC accepts any ISA intrinsics in any function; GCC and Clang need the
+// target to be enabled per function so the module itself can be built for
+// the baseline ISA and still carry the wider code paths.
+#ifdef _MSC_VER
+#define NATIVE_TARGET_SSE2
+#define NATIVE_TARGET_AVX2
+#define NATIVE_TARGET_AVX512
+#else
+#define NATIVE_TARGET_SSE2      __attribute__((target("sse2")))
+#define NATIVE_TARGET_AVX2      __attribute__((target("avx2,fma")))
+#define NATIVE_TARGET_AVX512    __attribute__((target("avx512f")))
+#endif
+
+// Function table for float pixel arithmetic. One table is selected at first
+// use from the instruction sets supported by the running CPU.
+struct NativeKernels
+{
+    const char* name;
+    void (*add)(float* d, const float* s, int n);
+    void (*sub)(float* d, const float* s, int n);
+    void (*rsub)(float* d, const float* s, int n);
+    void (*mul)(float* d, const float* s, int n);
+    void (*div)(float* d, const float* s, int n);
+    void (*addConst)(float* d, float c, int n);
+    void (*mulConst)(float* d, float c, int n);
+    void (*divConst)(float* d, float c, int n);
+    void (*clip)(float* d, int n);
+    void (*calibrate)(float* d, const float* s, const float* dark, float pedestal, const float* flatScale, int n);
+    void (*scale)(float* d, const float* s, float c, int n);
+    void (*madd)(float* d, const float* s, float c, int n);
+    void (*cosmetic3x3)(float* d, const float* r0, const float* r1, const float* r2, int n, bool invalidate);
+
+    static const NativeKernels& get();
+};
+
+// Branch-free median of p[0..8] (Paeth's 19 compare-exchange network). The
+// median ends up in p[4]; the other entries are left partially sorted.
+#define NATIVE_SORT2(a, b, vmin, vmax)  { auto t_ = vmin(a, b); b = vmax(a, b); a = t_; }
+#define NATIVE_MEDIAN9(p, vmin, vmax)   \
+    NATIVE_SORT2(p[1], p[2], vmin, vmax) NATIVE_SORT2(p[4], p[5], vmin, vmax) NATIVE_SORT2(p[7], p[8], vmin, vmax)  \
+    NATIVE_SORT2(p[0], p[1], vmin, vmax) NATIVE_SORT2(p[3], p[4], vmin, vmax) NATIVE_SORT2(p[6], p[7], vmin, vmax)  \
+    NATIVE_SORT2(p[1], p[2], vmin, vmax) NATIVE_SORT2(p[4], p[5], vmin, vmax) NATIVE_SORT2(p[7], p[8], vmin, vmax)  \
+    NATIVE_SORT2(p[0], p[3], vmin, vmax) NATIVE_SORT2(p[5], p[8], vmin, vmax) NATIVE_SORT2(p[4], p[7], vmin, vmax)  \
+    NATIVE_SORT2(p[3], p[6], vmin, vmax) NATIVE_SORT2(p[1], p[4], vmin, vmax) NATIVE_SORT2(p[2], p[5], vmin, vmax)  \
+    NATIVE_SORT2(p[4], p[7], vmin, vmax) NATIVE_SORT2(p[4], p[2], vmin, vmax) NATIVE_SORT2(p[6], p[4], vmin, vmax)  \
+    NATIVE_SORT2(p[4], p[2], vmin, vmax)
+
+// Reference implementation; also handles the tails of the vector kernels.
+struct NativeKernels_Scalar
+{
+    static void add(float* d, const float* s, int n)
+    {
+        for (int i = 0; i < n; i++)
+            d[i] += s[i];
+    }
+
+    static void sub(float* d, const float* s, int n)
+    {
+        for (int i = 0; i < n; i++)
+            d[i] -= s[i];
+    }
+
+    static void rsub(float* d, const float* s, int n)
+    {
+        for (int i = 0; i < n; i++)
+            d[i] = s[i] - d[i];
+    }
+
+    static void mul(float* d, const float* s, int n)
+    {
+        for (int i = 0; i < n; i++)
+            d[i] *= s[i];
+    }
+
+    static void div(float* d, const float* s, int n)
+    {
+        for (int i = 0; i < n; i++)
+            d[i] /= s[i];
+    }
+
+    static void addConst(float* d, float c, int n)
+    {
+        for (int i = 0; i < n; i++)
+            d[i] += c;
+    }
+
+    static void mulConst(float* d, float c, int n)
+    {
+        for (int i = 0; i < n; i++)
+            d[i] *= c;
+    }
+
+    static void divConst(float* d, float c, int n)
+    {
+        for (int i = 0; i < n; i++)
+            d[i] /= c;
+    }
+
+    // NaN samples are left untouched, as every comparison with NaN is false.
+    static void clip(float* d, int n)
+    {
+        for (int i = 0; i < n; i++)
+        {
+            float v = d[i];
+            v = (0.0f > v) ? 0.0f : v;
+            d[i] = (1.0f < v) ? 1.0f : v;
+        }
+    }
+
+    // d = (s - dark + pedestal) * flatScale, where flatScale = flatMean / flat.
+    // Without a dark the pedestal is not applied; either frame may be null.
+    static void calibrate(float* d, const float* s, const float* dark, float pedestal, const float* flatScale, int n)
+    {
+        if (dark && flatScale)
+        {
+            for (int i = 0; i < n; i++)
+                d[i] = (s[i] - dark[i] + pedestal) * flatScale[i];
+        }
+        else if (dark)
+        {
+            for (int i = 0; i < n; i++)
+                d[i] = s[i] - dark[i] + pedestal;
+        }
+        else if (flatScale)
+        {
+            for (int i = 0; i < n; i++)
+                d[i] = s[i] * flatScale[i];
+        }
+        else
+        {
+            for (int i = 0; i < n; i++)
+                d[i] = s[i];
+        }
+    }
+
+    // d = c * s
+    static void scale(float* d, const float* s, float c, int n)
+    {
+        for (int i = 0; i < n; i++)
+            d[i] = c * s[i];
+    }
+
+    // d += c * s
+    static void madd(float* d, const float* s, float c, int n)
+    {
+        for (int i = 0; i < n; i++)
+            d[i] += c * s[i];
+    }
+
+    // Same operand order and NaN behaviour as the SSE min/max instructions
+    static float min(float a, float b)
+    {
+        return (a < b) ? a : b;
+    }
+
+    static float max(float a, float b)
+    {
+        return (a > b) ? a : b;
+    }
+
+    // 3x3 outlier rejection over rows r0, r1, r2 (above, at and below the
+    // output row), for output columns 0..n-1 whose neighbours r*[-1] and
+    // r*[n] exist. A pixel further than 2 sigma from its neighbourhood mean is
+    // replaced by the neighbourhood median, or by NaN when invalidating.
+    static void cosmetic3x3(float* d, const float* r0, const float* r1, const float* r2, int n, bool invalidate)
+    {
+        for (int i = 0; i < n; i++)
+        {
+            float p[9] = { r0[i - 1], r0[i], r0[i + 1], r1[i - 1], r1[i], r1[i + 1], r2[i - 1], r2[i], r2[i + 1] };
+            float sum = (p[0] + p[3] + p[6]) + (p[1] + p[4] + p[7]) + (p[2] + p[5] + p[8]);
+            float mean = sum * (1.0f / 9);
+            float sum2 = 0.0f;
+            for (int k = 0; k < 9; k++)
+                sum2 += (p[k] - mean) * (p[k] - mean);
+            float var = sum2 * (1.0f / 9);
+            float v = r1[i];
+            float dv = v - mean;
+            if (dv * dv > 4.0f * var)
+            {
+                if (invalidate)
+                    v = std::numeric_limits<float>::quiet_NaN();
+                else
+                {
+                    NATIVE_MEDIAN9(p, min, max)
+                    v = p[4];
+                }
+            }
+            d[i] = v;
+        }
+    }
+};
+
+#ifdef NATIVE_KERNELS_X86
+
+// (x > y) ? a : b per lane
+NATIVE_TARGET_SSE2 inline __m128 nativeSelectGreater(__m128 x, __m128 y, __m128 a, __m128 b)
+{
+    __m128 m = _mm_cmpgt_ps(x, y);
+    return _mm_or_ps(_mm_and_ps(m, a), _mm_andnot_ps(m, b));
+}
+
+NATIVE_TARGET_AVX2 inline __m256 nativeSelectGreater(__m256 x, __m256 y, __m256 a, __m256 b)
+{
+    return _mm256_blendv_ps(b, a, _mm256_cmp_ps(x, y, _CMP_GT_OQ));
+}
+
+NATIVE_TARGET_AVX512 inline __m512 nativeSelectGreater(__m512 x, __m512 y, __m512 a, __m512 b)
+{
+    return _mm512_mask_blend_ps(_mm512_cmp_ps_mask(x, y, _CMP_GT_OQ), b, a);
+}
+
+// max(a, b) and min(a, b) return b when either operand is NaN, so passing the
+// sample as the second operand keeps clip() NaN-transparent like the scalar
+// version.
+#define NATIVE_DEFINE_SIMD_KERNELS(isa, target, vt, w, pfx) \
+struct NativeKernels_##isa  \
+{   \
+    static target void add(float* d, const float* s, int n)    \
+    {   \
+        int i = 0;  \
+        for (; i + w <= n; i += w)  \
+            pfx##_storeu_ps(d + i, pfx##_add_ps(pfx##_loadu_ps(d + i), pfx##_loadu_ps(s + i)));   \
+        NativeKernels_Scalar::add(d + i, s + i, n - i); \
+    }   \
+    \
+    static target void sub(float* d, const float* s, int n)    \
+    {   \
+        int i = 0;  \
+        for (; i + w <= n; i += w)  \
+            pfx##_storeu_ps(d + i, pfx##_sub_ps(pfx##_loadu_ps(d + i), pfx##_loadu_ps(s + i)));   \
+        NativeKernels_Scalar::sub(d + i, s + i, n - i); \
+    }   \
+    \
+    static target void rsub(float* d, const float* s, int n)   \
+    {   \
+        int i = 0;  \
+        for (; i + w <= n; i += w)  \
+            pfx##_storeu_ps(d + i, pfx##_sub_ps(pfx##_loadu_ps(s + i), pfx##_loadu_ps(d + i)));   \
+        NativeKernels_Scalar::rsub(d + i, s + i, n - i);    \
+    }   \
+    \
+    static target void mul(float* d, const float* s, int n)    \
+    {   \
+        int i = 0;  \
+        for (; i + w <= n; i += w)  \
+            pfx##_storeu_ps(d + i, pfx##_mul_ps(pfx##_loadu_ps(d + i), pfx##_loadu_ps(s + i)));   \
+        NativeKernels_Scalar::mul(d + i, s + i, n - i); \
+    }   \
+    \
+    static target void div(float* d, const float* s, int n)    \
+    {   \
+        int i = 0;  \
+        for (; i + w <= n; i += w)  \
+            pfx##_storeu_ps(d + i, pfx##_div_ps(pfx##_loadu_ps(d + i), pfx##_loadu_ps(s + i)));   \
+        NativeKernels_Scalar::div(d + i, s + i, n - i); \
+    }   \
+    \
+    static target void addConst(float* d, float c, int n)  \
+    {   \
+        vt vc = pfx##_set1_ps(c);   \
+        int i = 0;  \
+        for (; i + w <= n; i += w)  \
+            pfx##_storeu_ps(d + i, pfx##_add_ps(pfx##_loadu_ps(d + i), vc));  \
+        NativeKernels_Scalar::addConst(d + i, c, n - i);    \
+    }   \
+    \
+    static target void mulConst(float* d, float c, int n)  \
+    {   \
+        vt vc = pfx##_set1_ps(c);   \
+        int i = 0;  \
+        for (; i + w <= n; i += w)  \
+            pfx##_storeu_ps(d + i, pfx##_mul_ps(pfx##_loadu_ps(d + i), vc));  \
+        NativeKernels_Scalar::mulConst(d + i, c, n - i);    \
+    }   \
+    \
+    static target void divConst(float* d, float c, int n)  \
+    {   \
+        vt vc = pfx##_set1_ps(c);   \
+        int i = 0;  \
+        for (; i + w <= n; i += w)  \
+            pfx##_storeu_ps(d + i, pfx##_div_ps(pfx##_loadu_ps(d + i), vc));  \
+        NativeKernels_Scalar::divConst(d + i, c, n - i);    \
+    }   \
+    \
+    static target void clip(float* d, int n)  \
+    {   \
+        vt zero = pfx##_set1_ps(0.0f);  \
+        vt one = pfx##_set1_ps(1.0f);   \
+        int i = 0;  \
+        for (; i + w <= n; i += w)  \
+            pfx##_storeu_ps(d + i, pfx##_min_ps(one, pfx##_max_ps(zero, pfx##_loadu_ps(d + i))));    \
+        NativeKernels_Scalar::clip(d + i, n - i);   \
+    }   \
+    \
+    static target void calibrate(float* d, const float* s, const float* dark, float pedestal, const float* flatScale, int n)  \
+    {   \
+        vt vp = pfx##_set1_ps(pedestal);    \
+        int i = 0;  \
+        if (dark && flatScale)  \
+        {   \
+            for (; i + w <= n; i += w)  \
+                pfx##_storeu_ps(d + i, pfx##_mul_ps(pfx##_add_ps(pfx##_sub_ps(pfx##_loadu_ps(s + i), pfx##_loadu_ps(dark + i)), vp), pfx##_loadu_ps(flatScale + i)));  \
+        }   \
+        else if (dark)  \
+        {   \
+            for (; i + w <= n; i += w)  \
+                pfx##_storeu_ps(d + i, pfx##_add_ps(pfx##_sub_ps(pfx##_loadu_ps(s + i), pfx##_loadu_ps(dark + i)), vp));  \
+        }   \
+        else if (flatScale) \
+        {   \
+            for (; i + w <= n; i += w)  \
+                pfx##_storeu_ps(d + i, pfx##_mul_ps(pfx##_loadu_ps(s + i), pfx##_loadu_ps(flatScale + i)));  \
+        }   \
+        else    \
+        {   \
+            for (; i + w <= n; i += w)  \
+                pfx##_storeu_ps(d + i, pfx##_loadu_ps(s + i));  \
+        }   \
+        NativeKernels_Scalar::calibrate(d + i, s + i, dark ? dark + i : nullptr, pedestal, flatScale ? flatScale + i : nullptr, n - i);  \
+    }   \
+    \
+    static target void scale(float* d, const float* s, float c, int n)    \
+    {   \
+        vt vc = pfx##_set1_ps(c);   \
+        int i = 0;  \
+        for (; i + w <= n; i += w)  \
+            pfx##_storeu_ps(d + i, pfx##_mul_ps(vc, pfx##_loadu_ps(s + i)));  \
+        NativeKernels_Scalar::scale(d + i, s + i, c, n - i);    \
+    }   \
+    \
+    static target void madd(float* d, const float* s, float c, int n) \
+    {   \
+        vt vc = pfx##_set1_ps(c);   \
+        int i = 0;  \
+        for (; i + w <= n; i += w)  \
+            pfx##_storeu_ps(d + i, pfx##_add_ps(pfx##_loadu_ps(d + i), pfx##_mul_ps(vc, pfx##_loadu_ps(s + i))));  \
+        NativeKernels_Scalar::madd(d + i, s + i, c, n - i); \
+    }   \
+    \
+    static target void cosmetic3x3(float* d, const float* r0, const float* r1, const float* r2, int n, bool invalidate)   \
+    {   \
+        vt ninth = pfx##_set1_ps(1.0f / 9);   \
+        vt four = pfx##_set1_ps(4.0f);  \
+        vt nan = pfx##_set1_ps(std::numeric_limits<float>::quiet_NaN());  \
+        int i = 0;  \
+        for (; i + w <= n; i += w)  \
+        {   \
+            vt p[9] = { pfx##_loadu_ps(r0 + i - 1), pfx##_loadu_ps(r0 + i), pfx##_loadu_ps(r0 + i + 1),  \
+                        pfx##_loadu_ps(r1 + i - 1), pfx##_loadu_ps(r1 + i), pfx##_loadu_ps(r1 + i + 1),  \
+                        pfx##_loadu_ps(r2 + i - 1), pfx##_loadu_ps(r2 + i), pfx##_loadu_ps(r2 + i + 1) };   \
+            vt v = p[4];    \
+            /* Column sums of the three rows, then across the three columns */  \
+            vt c0 = pfx##_add_ps(pfx##_add_ps(p[0], p[3]), p[6]);   \
+            vt c1 = pfx##_add_ps(pfx##_add_ps(p[1], p[4]), p[7]);   \
+            vt c2 = pfx##_add_ps(pfx##_add_ps(p[2], p[5]), p[8]);   \
+            vt mean = pfx##_mul_ps(pfx##_add_ps(pfx##_add_ps(c0, c1), c2), ninth);    \
+            /* Mean squared deviation; sum(v^2)/9 - mean^2 cancels on flat areas */  \
+            vt var = pfx##_setzero_ps();    \
+            for (int k = 0; k < 9; k++) \
+            {   \
+                vt e = pfx##_sub_ps(p[k], mean);    \
+                var = pfx##_add_ps(var, pfx##_mul_ps(e, e));    \
+            }   \
+            var = pfx##_mul_ps(var, ninth); \
+            vt dv = pfx##_sub_ps(v, mean);  \
+            vt repl = nan;  \
+            if (!invalidate)    \
+            {   \
+                NATIVE_MEDIAN9(p, pfx##_min_ps, pfx##_max_ps)   \
+                repl = p[4];    \
+            }   \
+            pfx##_storeu_ps(d + i, nativeSelectGreater(pfx##_mul_ps(dv, dv), pfx##_mul_ps(four, var), repl, v)); \
+        }   \
+        NativeKernels_Scalar::cosmetic3x3(d + i, r0 + i, r1 + i, r2 + i, n - i, invalidate);    \
+    }   \
+};
+
+NATIVE_DEFINE_SIMD_KERNELS(SSE2, NATIVE_TARGET_SSE2, __m128, 4, _mm)
+NATIVE_DEFINE_SIMD_KERNELS(AVX2, NATIVE_TARGET_AVX2, __m256, 8, _mm256)
+NATIVE_DEFINE_SIMD_KERNELS(AVX512, NATIVE_TARGET_AVX512, __m512, 16, _mm512)
+
+#undef NATIVE_DEFINE_SIMD_KERNELS
+
+enum class NativeCpuLevel
+{
+    Scalar,
+    SSE2,
+    AVX2,
+    AVX512
+};
+
+inline NativeCpuLevel nativeCpuLevel()
+{
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 0);
+    int maxLeaf = info[0];
+    __cpuid(info, 1);
+    bool sse2 = (info[3] & (1 << 26)) != 0;
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    bool avx = (info[2] & (1 << 28)) != 0;
+    bool fma = (info[2] & (1 << 12)) != 0;
+    bool avx2 = false, avx512f = false;
+    if (maxLeaf >= 7)
+    {
+        __cpuidex(info, 7, 0);
+        avx2 = (info[1] & (1 << 5)) != 0;
+        avx512f = (info[1] & (1 << 16)) != 0;
+    }
+    // The OS must also save the wide registers on context switches
+    unsigned long long xcr0 = osxsave ? _xgetbv(0) : 0;
+    bool ymm = (xcr0 & 0x06) == 0x06;
+    bool zmm = (xcr0 & 0xe6) == 0xe6;
+    if (avx512f && zmm)
+        return NativeCpuLevel::AVX512;
+    if (avx && avx2 && fma && ymm)
+        return NativeCpuLevel::AVX2;
+    if (sse2)
+        return NativeCpuLevel::SSE2;
+    return NativeCpuLevel::Scalar;
+#else
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+        return NativeCpuLevel::AVX512;
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+        return NativeCpuLevel::AVX2;
+    if (__builtin_cpu_supports("sse2"))
+        return NativeCpuLevel::SSE2;
+    return NativeCpuLevel::Scalar;
+#endif
+}
+
+#endif  // NATIVE_KERNELS_X86
+
+#define NATIVE_KERNEL_TABLE(name, isa)  \
+    { name, &isa::add, &isa::sub, &isa::rsub, &isa::mul, &isa::div, &isa::addConst, &isa::mulConst, &isa::divConst, &isa::clip, &isa::calibrate, &isa::scale, &isa::madd, &isa::cosmetic3x3 }
+
+inline const NativeKernels& NativeKernels::get()
+{
+    static const NativeKernels scalar = NATIVE_KERNEL_TABLE("scalar", NativeKernels_Scalar);
+#ifdef NATIVE_KERNELS_X86
+    static const NativeKernels sse2 = NATIVE_KERNEL_TABLE("SSE2", NativeKernels_SSE2);
+    static const NativeKernels avx2 = NATIVE_KERNEL_TABLE("AVX2", NativeKernels_AVX2);
+    static const NativeKernels avx512 = NATIVE_KERNEL_TABLE("AVX-512", NativeKernels_AVX512);
+    static const NativeKernels* selected = []()
+    {
+        switch (nativeCpuLevel())
+        {
+        case NativeCpuLevel::AVX512:    return &avx512;
+        case NativeCpuLevel::AVX2:      return &avx2;
+        case NativeCpuLevel::SSE2:      return &sse2;
+        default:                        return &scalar;
+        }
+    }();
+    return *selected;
+#else
+    return scalar;
+#endif
+}
+
+#undef NATIVE_KERNEL_TABLE
+#undef NATIVE_MEDIAN9
+#undef NATIVE_SORT2
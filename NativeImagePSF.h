@@ -0,0 +1,417 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "NativeImage.h"
+
+enum class NativePSFModel
+{
+    Gaussian,
+    Moffat
+};
+
+// Elliptical PSF fitted to a star. Widths are full widths at half maximum in
+// pixels; the angle of the major axis is in degrees from +x towards +y, in
+// [0, 180).
+struct NativePSF
+{
+    float background = 0.0f;
+    float amplitude = 0.0f;
+    float x = 0.0f;
+    float y = 0.0f;
+    float fwhmX = 0.0f;         // extent of the half-maximum ellipse along x
+    float fwhmY = 0.0f;         // extent of the half-maximum ellipse along y
+    float fwhm = 0.0f;          // mean of the major and minor axis FWHMs
+    float ellipticity = 0.0f;   // 1 - minor / major
+    float angle = 0.0f;
+    float flux = 0.0f;          // integral of the profile above background
+    bool valid = false;
+};
+
+// Batched least-squares fit of 2D elliptical Gaussian or Moffat profiles,
+//
+//   f = B + A * exp(-Q / 2)          (Gaussian)
+//   f = B + A * (1 + Q)^-beta        (Moffat, fixed beta)
+//   Q = a11 u^2 + 2 a12 u v + a22 v^2, u = x - x0, v = y - y0
+//
+// to square stamps of equal size around each star. Stamps and parameters are
+// stored structure-of-arrays, pixel-major with one lane per star, so the
+// residual and Jacobian pass for a whole frame is a single loop over stars
+// that the compiler vectorizes. Each star runs its own Levenberg-Marquardt
+// damping; the passes continue until every star has converged. NaN pixels
+// get zero weight.
+class NativePSFFitter
+{
+public:
+    static constexpr int NumParameters = 7;     // B, A, x0, y0, a11, a12, a22
+
+private:
+    static constexpr int NumNormal = NumParameters * (NumParameters + 1) / 2 + NumParameters;
+
+    NativePSFModel m_model;
+    float m_beta;
+    int m_radius = 0;
+    int m_side = 0;
+    int m_capacity = 0;
+    int m_numStars = 0;
+    std::vector<float> m_pixels;        // [pixel][lane]
+    std::vector<float> m_weights;       // [pixel][lane]
+    std::vector<float> m_params;        // [parameter][lane]
+    std::vector<float> m_trial;         // [parameter][lane]
+    std::vector<float> m_normal;        // [J'J upper triangle, J'r][lane]
+    std::vector<float> m_cost;
+    std::vector<float> m_trialCost;
+    std::vector<float> m_lambda;
+    std::vector<float> m_derivatives;   // [parameter, weighted residual][lane], per pixel
+    std::vector<int> m_originX;
+    std::vector<int> m_originY;
+    std::vector<uint8_t> m_admitted;    // initial guess was admissible
+    std::vector<uint8_t> m_proposed;    // this iteration produced an admissible step
+    std::vector<int> m_star;            // star held by each lane
+    std::vector<int> m_lane;            // lane holding each star
+    int m_numActive = 0;                // lanes [0, m_numActive) are still iterating
+
+    float* param(std::vector<float>& p, int k)
+    {
+        return p.data() + size_t(k) * m_capacity;
+    }
+
+    const float* param(const std::vector<float>& p, int k) const
+    {
+        return p.data() + size_t(k) * m_capacity;
+    }
+
+    // Half-maximum width of the profile along an axis where Q = lambda r^2
+    float axisFwhm(double lambda) const
+    {
+        double r = 1.0 / std::sqrt(lambda);
+        if (m_model == NativePSFModel::Gaussian)
+            return float(2.0 * std::sqrt(2.0 * std::log(2.0)) * r);
+        return float(2.0 * r * std::sqrt(std::pow(2.0, 1.0 / m_beta) - 1.0));
+    }
+
+    bool admissible(const float* p) const
+    {
+        return (p[1] > 0.0f) && (p[2] >= 0.0f) && (p[2] <= m_side - 1) && (p[3] >= 0.0f) && (p[3] <= m_side - 1) &&
+               (p[4] > 0.0f) && (p[6] > 0.0f) && (p[4] * p[6] - p[5] * p[5] > 0.0f) &&
+               // The wider axis must stay within the stamp
+               (0.5f * (p[4] + p[6]) - std::sqrt(0.25f * (p[4] - p[6]) * (p[4] - p[6]) + p[5] * p[5]) > 1.0f / (m_side * m_side));
+    }
+
+    static bool solve(double a[NumParameters][NumParameters], double b[NumParameters], double x[NumParameters])
+    {
+        const int n = NumParameters;
+        int p[n];
+        for (int i = 0; i < n; i++)
+            p[i] = i;
+        for (int c = 0; c < n; c++)
+        {
+            int best = c;
+            for (int r = c + 1; r < n; r++)
+                if (std::abs(a[p[r]][c]) > std::abs(a[p[best]][c]))
+                    best = r;
+            std::swap(p[c], p[best]);
+            double d = a[p[c]][c];
+            if (!(std::abs(d) > 1.0e-300))
+                return false;
+            for (int r = c + 1; r < n; r++)
+            {
+                double f = a[p[r]][c] / d;
+                for (int k = c; k < n; k++)
+                    a[p[r]][k] -= f * a[p[c]][k];
+                b[p[r]] -= f * b[p[c]];
+            }
+        }
+        for (int c = n - 1; c >= 0; c--)
+        {
+            double s = b[p[c]];
+            for (int k = c + 1; k < n; k++)
+                s -= a[p[c]][k] * x[k];
+            x[c] = s / a[p[c]][c];
+        }
+        return true;
+    }
+
+    void swapLanes(int a, int b)
+    {
+        if (a == b)
+            return;
+        for (int k = 0; k < m_side * m_side; k++)
+        {
+            std::swap(m_pixels[size_t(k) * m_capacity + a], m_pixels[size_t(k) * m_capacity + b]);
+            std::swap(m_weights[size_t(k) * m_capacity + a], m_weights[size_t(k) * m_capacity + b]);
+        }
+        for (int k = 0; k < NumParameters; k++)
+            std::swap(param(m_params, k)[a], param(m_params, k)[b]);
+        std::swap(m_cost[a], m_cost[b]);
+        std::swap(m_lambda[a], m_lambda[b]);
+        std::swap(m_originX[a], m_originX[b]);
+        std::swap(m_originY[a], m_originY[b]);
+        std::swap(m_admitted[a], m_admitted[b]);
+        std::swap(m_star[a], m_star[b]);
+        m_lane[m_star[a]] = a;
+        m_lane[m_star[b]] = b;
+    }
+
+    // Moves a converged lane out of the active range at the front
+    void retire(int lane)
+    {
+        swapLanes(lane, --m_numActive);
+    }
+
+    // One pass over the active stamps: weighted sum of squared residuals into
+    // cost and, with Jacobian, the normal equations into m_normal
+    template<bool Moffat, bool Jacobian>
+    void evaluate(const std::vector<float>& params, std::vector<float>& cost)
+    {
+        const int n = m_numActive;
+        const float beta = m_beta;
+        const float* B = param(params, 0);
+        const float* A = param(params, 1);
+        const float* X0 = param(params, 2);
+        const float* Y0 = param(params, 3);
+        const float* A11 = param(params, 4);
+        const float* A12 = param(params, 5);
+        const float* A22 = param(params, 6);
+        float* c = cost.data();
+        std::fill(c, c + n, 0.0f);
+        float* nrm[NumNormal];
+        for (int k = 0; k < NumNormal; k++)
+        {
+            nrm[k] = m_normal.data() + size_t(k) * m_capacity;
+            if (Jacobian)
+                std::fill(nrm[k], nrm[k] + n, 0.0f);
+        }
+        float* d[NumParameters];
+        for (int k = 0; k < NumParameters; k++)
+            d[k] = m_derivatives.data() + size_t(k) * m_capacity;
+        float* wr = m_derivatives.data() + size_t(NumParameters) * m_capacity;
+        for (int j = 0; j < m_side; j++)
+            for (int i = 0; i < m_side; i++)
+            {
+                const float* pix = m_pixels.data() + size_t(j * m_side + i) * m_capacity;
+                const float* wgt = m_weights.data() + size_t(j * m_side + i) * m_capacity;
+                for (int s = 0; s < n; s++)
+                {
+                    float u = i - X0[s];
+                    float v = j - Y0[s];
+                    float q = A11[s] * u * u + 2.0f * A12[s] * u * v + A22[s] * v * v;
+                    float e = Moffat ? std::exp(-beta * std::log1p(q)) : std::exp(-0.5f * q);
+                    float r = pix[s] - (B[s] + A[s] * e);
+                    c[s] += wgt[s] * r * r;
+                    if (Jacobian)
+                    {
+                        // df/dQ, then the chain rule through Q
+                        float g = Moffat ? -A[s] * beta * e / (1.0f + q) : -0.5f * A[s] * e;
+                        d[0][s] = 1.0f;
+                        d[1][s] = e;
+                        d[2][s] = -2.0f * g * (A11[s] * u + A12[s] * v);
+                        d[3][s] = -2.0f * g * (A12[s] * u + A22[s] * v);
+                        d[4][s] = g * u * u;
+                        d[5][s] = 2.0f * g * u * v;
+                        d[6][s] = g * v * v;
+                        wr[s] = wgt[s] * r;
+                    }
+                }
+                if (Jacobian)
+                {
+                    // One plain loop per normal-equation term keeps every
+                    // accumulation vectorizable
+                    int k = 0;
+                    for (int a = 0; a < NumParameters; a++)
+                        for (int b = a; b < NumParameters; b++, k++)
+                            for (int s = 0; s < n; s++)
+                                nrm[k][s] += wgt[s] * d[a][s] * d[b][s];
+                    for (int a = 0; a < NumParameters; a++, k++)
+                        for (int s = 0; s < n; s++)
+                            nrm[k][s] += d[a][s] * wr[s];
+                }
+            }
+    }
+
+    template<bool Moffat>
+    void run(int maxIterations)
+    {
+        evaluate<Moffat, false>(m_params, m_cost);
+        for (int iteration = 0; (iteration < maxIterations) && (m_numActive > 0); iteration++)
+        {
+            const int n = m_numActive;
+            evaluate<Moffat, true>(m_params, m_cost);
+
+            // Damped step per star
+            for (int s = 0; s < n; s++)
+            {
+                double a[NumParameters][NumParameters], b[NumParameters], x[NumParameters];
+                int k = 0;
+                for (int i = 0; i < NumParameters; i++)
+                {
+                    for (int j = i; j < NumParameters; j++)
+                        a[i][j] = a[j][i] = m_normal[size_t(k++) * m_capacity + s];
+                    b[i] = m_normal[size_t(NumNormal - NumParameters + i) * m_capacity + s];
+                }
+                for (int i = 0; i < NumParameters; i++)
+                    a[i][i] += m_lambda[s] * std::max(a[i][i], 1.0e-12);
+                float t[NumParameters];
+                bool ok = solve(a, b, x);
+                for (int i = 0; i < NumParameters; i++)
+                    t[i] = param(m_params, i)[s] + float(ok ? x[i] : 0.0);
+                m_proposed[s] = ok && admissible(t);
+                for (int i = 0; i < NumParameters; i++)
+                    param(m_trial, i)[s] = m_proposed[s] ? t[i] : param(m_params, i)[s];
+            }
+
+            evaluate<Moffat, false>(m_trial, m_trialCost);
+
+            // Accept or reject, retiring converged lanes from the back so
+            // that the ones still to visit keep their positions
+            for (int s = n - 1; s >= 0; s--)
+            {
+                if (m_proposed[s] && (m_trialCost[s] < m_cost[s]))
+                {
+                    float dx = std::abs(param(m_trial, 2)[s] - param(m_params, 2)[s]);
+                    float dy = std::abs(param(m_trial, 3)[s] - param(m_params, 3)[s]);
+                    float dq = std::abs(param(m_trial, 4)[s] - param(m_params, 4)[s]) + std::abs(param(m_trial, 6)[s] - param(m_params, 6)[s]);
+                    for (int k = 0; k < NumParameters; k++)
+                        param(m_params, k)[s] = param(m_trial, k)[s];
+                    m_cost[s] = m_trialCost[s];
+                    m_lambda[s] = std::max(m_lambda[s] * 0.1f, 1.0e-7f);
+                    if ((dx < 1.0e-2f) && (dy < 1.0e-2f) && (dq < 1.0e-3f * (param(m_params, 4)[s] + param(m_params, 6)[s])))
+                        retire(s);
+                }
+                else
+                {
+                    m_lambda[s] *= 10.0f;
+                    if (m_lambda[s] > 1.0e+8f)
+                        retire(s);
+                }
+            }
+        }
+    }
+
+public:
+    explicit NativePSFFitter(NativePSFModel model = NativePSFModel::Gaussian, float beta = 4.0f)
+        : m_model(model)
+        , m_beta(beta)
+    {
+    }
+
+    NativePSFModel model() const
+    {
+        return m_model;
+    }
+
+    // Prepares for up to `capacity` stars with stamps of (2 radius + 1)^2 pixels
+    void begin(int radius, int capacity)
+    {
+        m_radius = std::max(radius, 1);
+        m_side = 2 * m_radius + 1;
+        m_capacity = std::max(capacity, 1);
+        m_numStars = 0;
+        size_t pixels = size_t(m_side) * m_side * m_capacity;
+        m_pixels.assign(pixels, 0.0f);
+        m_weights.assign(pixels, 0.0f);
+        m_params.assign(size_t(NumParameters) * m_capacity, 0.0f);
+        m_trial.assign(size_t(NumParameters) * m_capacity, 0.0f);
+        m_normal.resize(size_t(NumNormal) * m_capacity);
+        m_cost.assign(m_capacity, 0.0f);
+        m_trialCost.assign(m_capacity, 0.0f);
+        m_lambda.assign(m_capacity, 1.0e-3f);
+        m_originX.assign(m_capacity, 0);
+        m_originY.assign(m_capacity, 0);
+        m_derivatives.resize(size_t(NumParameters + 1) * m_capacity);
+        m_admitted.assign(m_capacity, 0);
+        m_proposed.assign(m_capacity, 0);
+        m_star.assign(m_capacity, 0);
+        m_lane.assign(m_capacity, 0);
+        m_numActive = 0;
+    }
+
+    int numStars() const
+    {
+        return m_numStars;
+    }
+
+    // Adds the star centred near (x, y) with an initial background, peak and
+    // FWHM guess; returns its index, or -1 when the batch is full
+    int add(const NativeImageView<const float>& img, float x, float y, float background, float peak, float fwhm)
+    {
+        if (m_numStars >= m_capacity)
+            return -1;
+        int s = m_numStars++;
+        int ox = int(std::floor(x + 0.5f)) - m_radius;
+        int oy = int(std::floor(y + 0.5f)) - m_radius;
+        m_originX[s] = ox;
+        m_originY[s] = oy;
+        for (int j = 0; j < m_side; j++)
+        {
+            int iy = std::max(0, std::min(img.height - 1, oy + j));
+            for (int i = 0; i < m_side; i++)
+            {
+                int ix = std::max(0, std::min(img.width - 1, ox + i));
+                float v = img(ix, iy);
+                bool inside = (ix == ox + i) && (iy == oy + j) && !std::isnan(v);
+                size_t k = size_t(j * m_side + i) * m_capacity + s;
+                m_pixels[k] = inside ? v : 0.0f;
+                m_weights[k] = inside ? 1.0f : 0.0f;
+            }
+        }
+        float r = std::max(fwhm, 1.0f) * 0.5f;
+        double lambda = (m_model == NativePSFModel::Gaussian) ? 2.0 * std::log(2.0) / (r * r) : (std::pow(2.0, 1.0 / m_beta) - 1.0) / (r * r);
+        float p[NumParameters] = { background, std::max(peak - background, 1.0e-6f), x - ox, y - oy, float(lambda), 0.0f, float(lambda) };
+        for (int k = 0; k < NumParameters; k++)
+            param(m_params, k)[s] = p[k];
+        m_lambda[s] = 1.0e-3f;
+        m_admitted[s] = admissible(p) ? 1 : 0;
+        m_star[s] = m_lane[s] = s;
+        return s;
+    }
+
+    void fit(int maxIterations = 20)
+    {
+        // Stars whose first guess is unusable never enter the active range
+        m_numActive = m_numStars;
+        for (int lane = m_numActive - 1; lane >= 0; lane--)
+            if (!m_admitted[lane])
+                retire(lane);
+        if (m_model == NativePSFModel::Moffat)
+            run<true>(maxIterations);
+        else
+            run<false>(maxIterations);
+    }
+
+    NativePSF result(int star) const
+    {
+        NativePSF psf;
+        int s = m_lane[star];
+        float p[NumParameters];
+        for (int k = 0; k < NumParameters; k++)
+            p[k] = param(m_params, k)[s];
+        psf.background = p[0];
+        psf.amplitude = p[1];
+        psf.x = m_originX[s] + p[2];
+        psf.y = m_originY[s] + p[3];
+        psf.valid = m_admitted[s] && admissible(p) && std::isfinite(m_cost[s]);
+        if (!psf.valid)
+            return psf;
+        double a11 = p[4], a12 = p[5], a22 = p[6];
+        double det = a11 * a22 - a12 * a12;
+        double m = 0.5 * (a11 + a22);
+        double d = std::sqrt(0.25 * (a11 - a22) * (a11 - a22) + a12 * a12);
+        float major = axisFwhm(m - d);
+        float minor = axisFwhm(m + d);
+        psf.fwhm = 0.5f * (major + minor);
+        psf.ellipticity = 1.0f - minor / major;
+        // The eigenvector of the larger eigenvalue is at 0.5 atan2(2 a12, a11 - a22);
+        // the major axis is perpendicular to it
+        double angle = 0.5 * std::atan2(2.0 * a12, a11 - a22) * 180.0 / 3.14159265358979323846 + 90.0;
+        psf.angle = float(std::fmod(angle + 180.0, 180.0));
+        psf.fwhmX = axisFwhm(det / a22);
+        psf.fwhmY = axisFwhm(det / a11);
+        double pi = 3.14159265358979323846;
+        psf.flux = float((m_model == NativePSFModel::Gaussian) ? 2.0 * pi * p[1] / std::sqrt(det) : pi * p[1] / ((m_beta - 1.0) * std::sqrt(det)));
+        return psf;
+    }
+};
@@ -0,0 +1,766 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include "NativeImage.h"
+#include "NativeImageAnalysis.h"
+
+enum class NativeInterpolation
+{
+    Nearest,
+    Bilinear,
+    Lanczos3,
+    Lanczos4,
+    Lanczos5
+};
+
+// Normalized Lanczos-n weights for the 2n taps around a sample position, with
+// the fractional offset quantized to 1/Resolution px. The analytic filter
+// costs a sin() per tap, which dominates when the displacement changes from
+// pixel to pixel; one table per radius is built on first use and then shared
+// read-only by all worker threads. Weights must be within MaxWeightError of
+// the analytic, normalized filter; see maxWeightError().
+class NativeLanczosLUT
+{
+public:
+    static constexpr int Resolution = 1024;
+    static constexpr float MaxWeightError = 1.0e-3f;
+
+    static const NativeLanczosLUT& get(int n)
+    {
+        static const NativeLanczosLUT lut3(3), lut4(4), lut5(5);
+        switch (n)
+        {
+        case 4:  return lut4;
+        case 5:  return lut5;
+        default: return lut3;
+        }
+    }
+
+    int radius() const
+    {
+        return m_n;
+    }
+
+    // Weights for the taps at offsets -n+1 .. n from int(x), f = x - int(x)
+    const float* weights(float f) const
+    {
+        return &m_weights[size_t(int(f * Resolution + 0.5f)) * m_taps];
+    }
+
+    // Same result and border clamping as NativeImageView::getLanczos
+    template<typename T>
+    float interpolate(const NativeImageView<T>& src, float x, float y) const
+    {
+        switch (m_n)
+        {
+        case 4:  return interpolateN<4>(src, x, y);
+        case 5:  return interpolateN<5>(src, x, y);
+        default: return interpolateN<3>(src, x, y);
+        }
+    }
+
+    // Largest deviation from the analytic weights over a fine sweep of
+    // fractional offsets
+    float maxWeightError() const
+    {
+        float maxError = 0.0f;
+        std::vector<float> w(m_taps);
+        for (int i = 0; i <= 16 * Resolution; i++)
+        {
+            float f = float(i) / (16 * Resolution);
+            analyticWeights(w.data(), f);
+            const float* q = weights(f);
+            for (int k = 0; k < m_taps; k++)
+                maxError = std::max(maxError, std::abs(w[k] - q[k]));
+        }
+        return maxError;
+    }
+
+private:
+    int m_n;
+    int m_taps;
+    std::vector<float> m_weights;   // (Resolution + 1) rows of m_taps weights
+
+    explicit NativeLanczosLUT(int n)
+        : m_n(n)
+        , m_taps(2 * n)
+        , m_weights(size_t(Resolution + 1) * 2 * n)
+    {
+        for (int i = 0; i <= Resolution; i++)
+            analyticWeights(&m_weights[size_t(i) * m_taps], float(i) / Resolution);
+    }
+
+    void analyticWeights(float* w, float f) const
+    {
+        float sum = 0.0f;
+        for (int k = 0; k < m_taps; k++)
+        {
+            w[k] = NativeImageView<const float>::lanczos(k - m_n + 1 - f, m_n);
+            sum += w[k];
+        }
+        for (int k = 0; k < m_taps; k++)
+            w[k] /= sum;
+    }
+
+    // The fixed 2N x 2N footprint lets the compiler fully unroll and
+    // vectorize the row dot products
+    template<int N, typename T>
+    float interpolateN(const NativeImageView<T>& src, float x, float y) const
+    {
+        if (x < N)
+            x = N;
+        else if (x > src.width - N - 1)
+            x = src.width - N - 1;
+        if (y < N)
+            y = N;
+        else if (y > src.height - N - 1)
+            y = src.height - N - 1;
+        int x0 = int(x);
+        int y0 = int(y);
+        const float* wx = weights(x - x0);
+        const float* wy = weights(y - y0);
+        float value = 0.0f;
+        for (int i = 0; i < 2 * N; i++)
+        {
+            const T* r = src.row(y0 - N + 1 + i) + x0 - N + 1;
+            float h = 0.0f;
+            for (int k = 0; k < 2 * N; k++)
+                h += wx[k] * static_cast<float>(r[k]);
+            value += wy[i] * h;
+        }
+        return value;
+    }
+};
+
+// Whole-image subpixel translation, dst(x, y) = src(x + dx, y + dy), for the
+// case where every pixel moves by the same displacement. The filter weights
+// depend only on the fractional part of the shift, so they are computed once
+// per frame and per axis, and the 2D filter is applied as a horizontal pass
+// followed by a vertical pass. Horizontally filtered rows are kept in a small
+// ring buffer, so each source row is filtered once and the vertical pass works
+// on cache-resident data. Sampling positions are clamped at the borders
+// exactly like NativeImageView::getNearest/getBilinear/getLanczos.
+class NativeImageShift
+{
+private:
+    // Per output coordinate: first source sample and filter weights
+    struct AxisPlan
+    {
+        int taps = 0;
+        std::vector<int> first;
+        std::vector<float> weights;     // taps per coordinate
+        int interiorBegin = 0;          // coordinates that were not clamped
+        int interiorEnd = 0;
+    };
+
+    NativeInterpolation m_interpolation;
+    AxisPlan m_planX;
+    AxisPlan m_planY;
+    std::vector<float> m_ring;          // taps horizontally filtered rows
+    std::vector<int> m_ringRow;         // source row held by each ring slot
+
+    int radius() const
+    {
+        switch (m_interpolation)
+        {
+        case NativeInterpolation::Lanczos3: return 3;
+        case NativeInterpolation::Lanczos4: return 4;
+        case NativeInterpolation::Lanczos5: return 5;
+        default:                            return 1;
+        }
+    }
+
+    void buildPlan(AxisPlan& plan, int length, float d) const
+    {
+        int n = radius();
+        plan.taps = (m_interpolation == NativeInterpolation::Nearest) ? 1 : 2 * n;
+        plan.first.resize(length);
+        plan.weights.resize(size_t(length) * plan.taps);
+        plan.interiorBegin = length;
+        plan.interiorEnd = 0;
+        for (int c = 0; c < length; c++)
+        {
+            float s = c + d;
+            float* w = &plan.weights[size_t(c) * plan.taps];
+            bool clamped = false;
+            if (m_interpolation == NativeInterpolation::Nearest)
+            {
+                // int() truncates toward zero, so everything below 0.5 maps
+                // to the first column
+                int i = int(s + 0.5f);
+                if (s < 0.5f)
+                    i = 0, clamped = true;
+                else if (i > length - 1)
+                    i = length - 1, clamped = true;
+                plan.first[c] = i;
+                w[0] = 1.0f;
+            }
+            else if (m_interpolation == NativeInterpolation::Bilinear)
+            {
+                if (s < 1)
+                    s = 1, clamped = true;
+                else if (s > length - 2)
+                    s = length - 2, clamped = true;
+                int i = int(s);
+                float f = s - i;
+                plan.first[c] = i;
+                w[0] = 1.0f - f;
+                w[1] = f;
+            }
+            else
+            {
+                if (s < n)
+                    s = n, clamped = true;
+                else if (s > length - n - 1)
+                    s = length - n - 1, clamped = true;
+                int i = int(s);
+                float f = s - i;
+                plan.first[c] = i - n + 1;
+                float sum = 0.0f;
+                for (int k = 0; k < plan.taps; k++)
+                {
+                    w[k] = NativeImageView<const float>::lanczos(k - n + 1 - f, n);
+                    sum += w[k];
+                }
+                for (int k = 0; k < plan.taps; k++)
+                    w[k] /= sum;
+            }
+            if (!clamped)
+            {
+                if (c < plan.interiorBegin)
+                    plan.interiorBegin = c;
+                plan.interiorEnd = c + 1;
+            }
+        }
+        if (plan.interiorEnd < plan.interiorBegin)
+            plan.interiorBegin = plan.interiorEnd = 0;
+    }
+
+    void filterRow(float* dst, const float* src, int width) const
+    {
+        const NativeKernels& kernels = NativeKernels::get();
+        const AxisPlan& p = m_planX;
+        int taps = p.taps;
+        // Border columns, each with its own clamped weights
+        for (int x = 0; x < width; x++)
+        {
+            if (x == p.interiorBegin)
+                x = p.interiorEnd;
+            if (x >= width)
+                break;
+            const float* w = &p.weights[size_t(x) * taps];
+            const float* s = src + p.first[x];
+            float v = 0.0f;
+            for (int k = 0; k < taps; k++)
+                v += w[k] * s[k];
+            dst[x] = v;
+        }
+        // Interior: a constant FIR, applied as one vector multiply-add per tap
+        int n = p.interiorEnd - p.interiorBegin;
+        if (n <= 0)
+            return;
+        const float* w = &p.weights[size_t(p.interiorBegin) * taps];
+        const float* s = src + p.first[p.interiorBegin];
+        float* d = dst + p.interiorBegin;
+        kernels.scale(d, s, w[0], n);
+        for (int k = 1; k < taps; k++)
+            kernels.madd(d, s + k, w[k], n);
+    }
+
+    const float* filteredRow(const NativeImageView<const float>& src, int y)
+    {
+        int slot = y % m_planY.taps;
+        float* row = &m_ring[size_t(slot) * src.width];
+        if (m_ringRow[slot] != y)
+        {
+            filterRow(row, src.row(y), src.width);
+            m_ringRow[slot] = y;
+        }
+        return row;
+    }
+
+public:
+    explicit NativeImageShift(NativeInterpolation interpolation)
+        : m_interpolation(interpolation)
+    {
+    }
+
+    void apply(const NativeImageView<float>& dst, const NativeImageView<const float>& src, float dx, float dy)
+    {
+        const NativeKernels& kernels = NativeKernels::get();
+        buildPlan(m_planX, src.width, dx);
+        buildPlan(m_planY, src.height, dy);
+        int taps = m_planY.taps;
+        m_ring.resize(size_t(taps) * src.width);
+        m_ringRow.assign(taps, -1);
+        for (int y = 0; y < dst.height; y++)
+        {
+            const float* w = &m_planY.weights[size_t(y) * taps];
+            int first = m_planY.first[y];
+            float* d = dst.row(y);
+            kernels.scale(d, filteredRow(src, first), w[0], dst.width);
+            for (int k = 1; k < taps; k++)
+                kernels.madd(d, filteredRow(src, first + k), w[k], dst.width);
+        }
+    }
+};
+
+// Star position in the current frame and its displacement from the reference
+// frame, as used by the digital AO warps
+struct NativeControlPoint
+{
+    float x;
+    float y;
+    float dx;
+    float dy;
+};
+
+// Inverse-distance weighted displacement field, evaluated on a coarse grid of
+// nodes every `spacing` px and bilinearly interpolated in between. The cost of
+// the star loop is paid per node instead of per pixel, which makes the warp
+// almost independent of the frame size. Each node only weights its Neighbours
+// nearest control points, found through a NativePointGrid, so the field
+// follows local distortions and the node cost does not grow with the number
+// of stars either.
+class NativeDisplacementGrid
+{
+public:
+    static constexpr int Neighbours = 16;
+
+private:
+    int m_width = 0;
+    int m_height = 0;
+    int m_spacing = 1;
+    int m_nodesX = 0;
+    int m_nodesY = 0;
+    std::vector<float> m_nodeDx;
+    std::vector<float> m_nodeDy;
+    std::vector<float> m_columnDx;      // grid row interpolated at the current y
+    std::vector<float> m_columnDy;
+    std::vector<float> m_rowDx;         // per-pixel displacements of the current row
+    std::vector<float> m_rowDy;
+    NativePointGrid m_index;            // control points
+    std::vector<int> m_neighbours;
+
+    void interpolateRow(int y)
+    {
+        int gy = y / m_spacing;
+        float ty = float(y - gy * m_spacing) / m_spacing;
+        const float* dx0 = &m_nodeDx[size_t(gy) * m_nodesX];
+        const float* dy0 = &m_nodeDy[size_t(gy) * m_nodesX];
+        const float* dx1 = dx0 + m_nodesX;
+        const float* dy1 = dy0 + m_nodesX;
+        for (int i = 0; i < m_nodesX; i++)
+        {
+            m_columnDx[i] = dx0[i] + (dx1[i] - dx0[i]) * ty;
+            m_columnDy[i] = dy0[i] + (dy1[i] - dy0[i]) * ty;
+        }
+        for (int x = 0; x < m_width; x++)
+        {
+            int gx = x / m_spacing;
+            float tx = float(x - gx * m_spacing) / m_spacing;
+            m_rowDx[x] = m_columnDx[gx] + (m_columnDx[gx + 1] - m_columnDx[gx]) * tx;
+            m_rowDy[x] = m_columnDy[gx] + (m_columnDy[gx + 1] - m_columnDy[gx]) * tx;
+        }
+    }
+
+public:
+    void build(const std::vector<NativeControlPoint>& points, int width, int height, int spacing)
+    {
+        m_width = width;
+        m_height = height;
+        m_spacing = std::max(1, spacing);
+        // One node past the last pixel so every pixel lies inside a cell
+        m_nodesX = (width - 1) / m_spacing + 2;
+        m_nodesY = (height - 1) / m_spacing + 2;
+        m_nodeDx.resize(size_t(m_nodesX) * m_nodesY);
+        m_nodeDy.resize(size_t(m_nodesX) * m_nodesY);
+        m_columnDx.resize(m_nodesX);
+        m_columnDy.resize(m_nodesX);
+        m_rowDx.resize(width);
+        m_rowDy.resize(width);
+        // Cells holding a few control points each on average
+        float cellSize = std::sqrt(float(width) * height * 4.0f / std::max<size_t>(points.size(), 1));
+        m_index.build(points, cellSize);
+        for (int j = 0; j < m_nodesY; j++)
+            for (int i = 0; i < m_nodesX; i++)
+            {
+                float x = float(i * m_spacing);
+                float y = float(j * m_spacing);
+                float dx = 0.0f, dy = 0.0f, w0 = 0.0f;
+                m_index.nearest(x, y, Neighbours, m_neighbours);
+                for (int n : m_neighbours)
+                {
+                    const NativeControlPoint& p = points[n];
+                    float d2 = (p.x - x) * (p.x - x) + (p.y - y) * (p.y - y);
+                    float w = 1.0f / (d2 + 1.0f);
+                    dx += p.dx * w;
+                    dy += p.dy * w;
+                    w0 += w;
+                }
+                size_t k = size_t(j) * m_nodesX + i;
+                m_nodeDx[k] = (w0 > 0) ? dx / w0 : 0.0f;
+                m_nodeDy[k] = (w0 > 0) ? dy / w0 : 0.0f;
+            }
+    }
+
+    // dst(x, y) = sample(x + dx(x, y), y + dy(x, y))
+    template<typename F>
+    void warp(const NativeImageView<float>& dst, F sample)
+    {
+        for (int y = 0; y < dst.height; y++)
+        {
+            interpolateRow(y);
+            float* r = dst.row(y);
+            for (int x = 0; x < dst.width; x++)
+                r[x] = sample(x + m_rowDx[x], y + m_rowDy[x]);
+        }
+    }
+};
+
+// Piecewise-affine warp over a Delaunay triangulation of the reference star
+// positions. The triangulation and the rasterization of its triangles into
+// per-row spans depend only on the reference frame, so both are done once
+// per run and shared read-only by all worker threads. Per frame, each
+// triangle gets the affine map that takes its vertices to their current
+// positions, and every pixel evaluates only the map of the triangle that
+// covers it. Pixels outside the convex hull use a global shift.
+class NativePiecewiseAffineWarp
+{
+private:
+    struct Triangle
+    {
+        int a, b, c;
+        double cx, cy, r2;  // circumcircle
+    };
+
+    struct Span
+    {
+        int y;
+        int x0, x1;         // inclusive
+        int triangle;
+    };
+
+    std::vector<float> m_x;
+    std::vector<float> m_y;
+    std::vector<Triangle> m_triangles;
+    int m_width = 0;
+    int m_height = 0;
+    std::vector<Span> m_spans;
+    std::vector<int> m_rowSpans;        // first span of each row, height + 1 entries
+
+    static Triangle makeTriangle(const std::vector<float>& x, const std::vector<float>& y, int a, int b, int c)
+    {
+        double ax = x[a], ay = y[a], bx = x[b], by = y[b], qx = x[c], qy = y[c];
+        double d = 2 * (ax * (by - qy) + bx * (qy - ay) + qx * (ay - by));
+        Triangle t = { a, b, c, 0.0, 0.0, std::numeric_limits<double>::infinity() };
+        if (d == 0)
+            return t;   // collinear, always removed by the next insertion
+        double a2 = ax * ax + ay * ay, b2 = bx * bx + by * by, q2 = qx * qx + qy * qy;
+        double cx = (a2 * (by - qy) + b2 * (qy - ay) + q2 * (ay - by)) / d;
+        double cy = (a2 * (qx - bx) + b2 * (ax - qx) + q2 * (bx - ax)) / d;
+        t.cx = cx;
+        t.cy = cy;
+        t.r2 = (ax - cx) * (ax - cx) + (ay - cy) * (ay - cy);
+        return t;
+    }
+
+    // x range of triangle t on row y, false if the row misses it
+    bool rowExtent(const Triangle& t, float y, float& xl, float& xr) const
+    {
+        const int v[3] = { t.a, t.b, t.c };
+        xl = 1.0e30f;
+        xr = -1.0e30f;
+        for (int k = 0; k < 3; k++)
+        {
+            int i = v[k], j = v[(k + 1) % 3];
+            float y0 = m_y[i], y1 = m_y[j];
+            if ((y < std::min(y0, y1)) || (y > std::max(y0, y1)))
+                continue;
+            float x = (y0 == y1) ? m_x[i] : m_x[i] + (m_x[j] - m_x[i]) * (y - y0) / (y1 - y0);
+            xl = std::min(xl, (y0 == y1) ? std::min(m_x[i], m_x[j]) : x);
+            xr = std::max(xr, (y0 == y1) ? std::max(m_x[i], m_x[j]) : x);
+        }
+        return xl <= xr;
+    }
+
+public:
+    // Bowyer-Watson triangulation of the reference positions (dx, dy unused).
+    // The circumcircles are computed from positions jittered by a thousandth
+    // of a pixel, so that coincident or collinear stars do not make
+    // degenerate triangles; rasterization uses the exact positions.
+    void triangulate(const std::vector<NativeControlPoint>& vertices)
+    {
+        int n = int(vertices.size());
+        m_x.resize(n + 3);
+        m_y.resize(n + 3);
+        float minX = 0, minY = 0, maxX = 0, maxY = 0;
+        for (int i = 0; i < n; i++)
+        {
+            m_x[i] = vertices[i].x;
+            m_y[i] = vertices[i].y;
+            minX = (i == 0) ? m_x[i] : std::min(minX, m_x[i]);
+            maxX = (i == 0) ? m_x[i] : std::max(maxX, m_x[i]);
+            minY = (i == 0) ? m_y[i] : std::min(minY, m_y[i]);
+            maxY = (i == 0) ? m_y[i] : std::max(maxY, m_y[i]);
+        }
+        // Super triangle enclosing all points
+        float size = std::max(maxX - minX, maxY - minY) + 1.0f;
+        float midX = 0.5f * (minX + maxX), midY = 0.5f * (minY + maxY);
+        m_x[n] = midX - 20 * size;  m_y[n] = midY - size;
+        m_x[n + 1] = midX;          m_y[n + 1] = midY + 20 * size;
+        m_x[n + 2] = midX + 20 * size;  m_y[n + 2] = midY - size;
+        std::vector<float> jx(m_x), jy(m_y);
+        for (int i = 0; i < n; i++)
+        {
+            uint32_t hash = uint32_t(i + 1) * 2654435761u;
+            jx[i] += ((hash >> 8 & 0xff) - 127.5f) * 1.0e-5f;
+            jy[i] += ((hash >> 16 & 0xff) - 127.5f) * 1.0e-5f;
+        }
+
+        m_triangles.clear();
+        m_triangles.push_back(makeTriangle(jx, jy, n, n + 1, n + 2));
+        std::vector<std::pair<int, int>> edges;
+        for (int i = 0; i < n; i++)
+        {
+            double px = jx[i], py = jy[i];
+            edges.clear();
+            for (size_t k = 0; k < m_triangles.size();)
+            {
+                const Triangle& t = m_triangles[k];
+                double ddx = px - t.cx, ddy = py - t.cy;
+                if (ddx * ddx + ddy * ddy < t.r2)
+                {
+                    edges.emplace_back(t.a, t.b);
+                    edges.emplace_back(t.b, t.c);
+                    edges.emplace_back(t.c, t.a);
+                    m_triangles[k] = m_triangles.back();
+                    m_triangles.pop_back();
+                }
+                else
+                    k++;
+            }
+            // The boundary of the cavity is made of the edges seen only once
+            for (size_t e = 0; e < edges.size(); e++)
+            {
+                bool shared = false;
+                for (size_t f = 0; f < edges.size(); f++)
+                    if ((e != f) && (((edges[e].first == edges[f].first) && (edges[e].second == edges[f].second)) ||
+                                     ((edges[e].first == edges[f].second) && (edges[e].second == edges[f].first))))
+                    {
+                        shared = true;
+                        break;
+                    }
+                if (!shared)
+                    m_triangles.push_back(makeTriangle(jx, jy, edges[e].first, edges[e].second, i));
+            }
+        }
+        m_triangles.erase(std::remove_if(m_triangles.begin(), m_triangles.end(),
+                                         [n](const Triangle& t) { return (t.a >= n) || (t.b >= n) || (t.c >= n); }),
+                          m_triangles.end());
+        m_x.resize(n);
+        m_y.resize(n);
+        m_width = m_height = 0;
+    }
+
+    int numTriangles() const
+    {
+        return int(m_triangles.size());
+    }
+
+    bool isRasterized(int width, int height) const
+    {
+        return (m_width == width) && (m_height == height);
+    }
+
+    // Triangle coverage as sorted, non-overlapping spans per image row
+    void rasterize(int width, int height)
+    {
+        m_spans.clear();
+        for (int t = 0; t < numTriangles(); t++)
+        {
+            const Triangle& tr = m_triangles[t];
+            float minY = std::min({ m_y[tr.a], m_y[tr.b], m_y[tr.c] });
+            float maxY = std::max({ m_y[tr.a], m_y[tr.b], m_y[tr.c] });
+            int y0 = std::max(0, int(std::ceil(minY)));
+            int y1 = std::min(height - 1, int(std::floor(maxY)));
+            for (int y = y0; y <= y1; y++)
+            {
+                float xl, xr;
+                if (!rowExtent(tr, float(y), xl, xr))
+                    continue;
+                int x0 = std::max(0, int(std::ceil(xl)));
+                int x1 = std::min(width - 1, int(std::floor(xr)));
+                if (x0 <= x1)
+                    m_spans.push_back({ y, x0, x1, t });
+            }
+        }
+        std::sort(m_spans.begin(), m_spans.end(),
+                  [](const Span& s1, const Span& s2) { return (s1.y < s2.y) || ((s1.y == s2.y) && (s1.x0 < s2.x0)); });
+        // Pixels on shared edges belong to the first triangle that reaches them
+        std::vector<Span> spans;
+        spans.reserve(m_spans.size());
+        for (Span s : m_spans)
+        {
+            if (!spans.empty() && (spans.back().y == s.y) && (s.x0 <= spans.back().x1))
+                s.x0 = spans.back().x1 + 1;
+            if (s.x0 <= s.x1)
+                spans.push_back(s);
+        }
+        m_spans.swap(spans);
+        m_rowSpans.assign(height + 1, 0);
+        for (const Span& s : m_spans)
+            m_rowSpans[s.y + 1]++;
+        for (int y = 0; y < height; y++)
+            m_rowSpans[y + 1] += m_rowSpans[y];
+        m_width = width;
+        m_height = height;
+    }
+
+    // dst(x, y) = sample(A_t(x, y)), where A_t takes each vertex of triangle t
+    // to (x + dx, y + dy) of the matching entry of `vertices`, in
+    // triangulation order. Pixels outside the hull are shifted by (dx, dy).
+    template<typename F>
+    void warp(const NativeImageView<float>& dst, const std::vector<NativeControlPoint>& vertices, float dx, float dy, F sample) const
+    {
+        std::vector<float> affine(size_t(numTriangles()) * 6);
+        for (int t = 0; t < numTriangles(); t++)
+        {
+            const Triangle& tr = m_triangles[t];
+            const NativeControlPoint& p0 = vertices[tr.a];
+            const NativeControlPoint& p1 = vertices[tr.b];
+            const NativeControlPoint& p2 = vertices[tr.c];
+            float* A = &affine[size_t(t) * 6];
+            float x1 = p1.x - p0.x, y1 = p1.y - p0.y, x2 = p2.x - p0.x, y2 = p2.y - p0.y;
+            float det = x1 * y2 - x2 * y1;
+            if (std::abs(det) < 1.0e-6f)
+            {
+                // Degenerate: translate by the mean vertex displacement
+                A[0] = 1; A[1] = 0; A[2] = (p0.dx + p1.dx + p2.dx) / 3;
+                A[3] = 0; A[4] = 1; A[5] = (p0.dy + p1.dy + p2.dy) / 3;
+                continue;
+            }
+            float u1 = x1 + p1.dx - p0.dx, u2 = x2 + p2.dx - p0.dx;
+            float v1 = y1 + p1.dy - p0.dy, v2 = y2 + p2.dy - p0.dy;
+            A[0] = (u1 * y2 - u2 * y1) / det;
+            A[1] = (x1 * u2 - x2 * u1) / det;
+            A[2] = p0.x + p0.dx - A[0] * p0.x - A[1] * p0.y;
+            A[3] = (v1 * y2 - v2 * y1) / det;
+            A[4] = (x1 * v2 - x2 * v1) / det;
+            A[5] = p0.y + p0.dy - A[3] * p0.x - A[4] * p0.y;
+        }
+        for (int y = 0; y < dst.height; y++)
+        {
+            float* r = dst.row(y);
+            int x = 0;
+            for (int k = m_rowSpans[y]; k < m_rowSpans[y + 1]; k++)
+            {
+                const Span& s = m_spans[k];
+                for (; x < s.x0; x++)
+                    r[x] = sample(x + dx, y + dy);
+                const float* A = &affine[size_t(s.triangle) * 6];
+                for (; x <= s.x1; x++)
+                    r[x] = sample(A[0] * x + A[1] * y + A[2], A[3] * x + A[4] * y + A[5]);
+            }
+            for (; x < dst.width; x++)
+                r[x] = sample(x + dx, y + dy);
+        }
+    }
+};
+
+// Constant-velocity Kalman filter for the motion of the whole star field,
+// one independent two-state (offset, velocity) filter per axis. The offset is
+// measured against the reference frame; the process noise models frame-to-
+// frame changes of the drift rate and the measurement noise the seeing
+// jitter of the measured offset, both in pixels squared.
+class NativeMotionFilter
+{
+private:
+    struct Axis
+    {
+        double p = 0.0;
+        double v = 0.0;
+        double P00 = 0.0;           // the reference frame defines offset 0 exactly
+        double P01 = 0.0;
+        double P11 = 100.0;         // the drift rate is unknown
+
+        void predict(double q)
+        {
+            p += v;
+            // P = F P F' + Q for F = [1 1; 0 1], Q = q [1/4 1/2; 1/2 1]
+            P00 += 2.0 * P01 + P11 + 0.25 * q;
+            P01 += P11 + 0.5 * q;
+            P11 += q;
+        }
+
+        double update(double z, double r)
+        {
+            double innovation = z - p;
+            double s = P00 + r;
+            double k0 = P00 / s, k1 = P01 / s;
+            p += k0 * innovation;
+            v += k1 * innovation;
+            P11 -= k1 * P01;
+            P01 -= k0 * P01;
+            P00 -= k0 * P00;
+            return innovation;
+        }
+    };
+
+    Axis m_x;
+    Axis m_y;
+    double m_processNoise;
+    double m_measurementNoise;
+
+public:
+    explicit NativeMotionFilter(double processNoise = 0.05, double measurementNoise = 1.0)
+        : m_processNoise(processNoise)
+        , m_measurementNoise(measurementNoise)
+    {
+    }
+
+    // Expected motion from the last filtered frame to the next one
+    float stepX() const
+    {
+        return float(m_x.v);
+    }
+
+    float stepY() const
+    {
+        return float(m_y.v);
+    }
+
+    float offsetX() const
+    {
+        return float(m_x.p);
+    }
+
+    float offsetY() const
+    {
+        return float(m_y.p);
+    }
+
+    // Advances one frame and fuses the measured offset of that frame; returns
+    // the prediction residual, the distance between measured and predicted
+    // offsets
+    float update(float x, float y)
+    {
+        m_x.predict(m_processNoise);
+        m_y.predict(m_processNoise);
+        double ex = m_x.update(x, m_measurementNoise);
+        double ey = m_y.update(y, m_measurementNoise);
+        return float(std::sqrt(ex * ex + ey * ey));
+    }
+
+    // Advances one frame without a measurement, when no star was tracked
+    void coast()
+    {
+        m_x.predict(m_processNoise);
+        m_y.predict(m_processNoise);
+    }
+};
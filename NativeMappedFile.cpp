@@ -0,0 +1,104 @@
+#include "NativeMappedFile.h"
+
+#ifdef _WIN32
+
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+
+#include <vector>
+
+struct NativeMappedFileHandle
+{
+    HANDLE file;
+    HANDLE mapping;
+};
+
+bool NativeMappedFile::open(const char* path)
+{
+    close();
+    int n = MultiByteToWideChar(CP_UTF8, 0, path, -1, nullptr, 0);
+    if (n <= 0)
+        return false;
+    std::vector<wchar_t> widePath(n);
+    MultiByteToWideChar(CP_UTF8, 0, path, -1, widePath.data(), n);
+    HANDLE file = CreateFileW(widePath.data(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+        return false;
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size) || (size.QuadPart == 0))
+    {
+        CloseHandle(file);
+        return false;
+    }
+    HANDLE mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mapping == nullptr)
+    {
+        CloseHandle(file);
+        return false;
+    }
+    const void* data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (data == nullptr)
+    {
+        CloseHandle(mapping);
+        CloseHandle(file);
+        return false;
+    }
+    m_data = static_cast<const uint8_t*>(data);
+    m_size = size_t(size.QuadPart);
+    m_handle = new NativeMappedFileHandle{ file, mapping };
+    return true;
+}
+
+void NativeMappedFile::close()
+{
+    if (m_data == nullptr)
+        return;
+    NativeMappedFileHandle* handle = static_cast<NativeMappedFileHandle*>(m_handle);
+    UnmapViewOfFile(m_data);
+    CloseHandle(handle->mapping);
+    CloseHandle(handle->file);
+    delete handle;
+    m_data = nullptr;
+    m_size = 0;
+    m_handle = nullptr;
+}
+
+#else
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+bool NativeMappedFile::open(const char* path)
+{
+    close();
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    if ((fstat(fd, &st) != 0) || (st.st_size == 0))
+    {
+        ::close(fd);
+        return false;
+    }
+    void* data = mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);        // the mapping keeps the file referenced
+    if (data == MAP_FAILED)
+        return false;
+    m_data = static_cast<const uint8_t*>(data);
+    m_size = size_t(st.st_size);
+    return true;
+}
+
+void NativeMappedFile::close()
+{
+    if (m_data == nullptr)
+        return;
+    munmap(const_cast<uint8_t*>(m_data), m_size);
+    m_data = nullptr;
+    m_size = 0;
+}
+
+#endif
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Read-only memory mapping of a whole file. Pages are loaded by the operating
+// system on first access, so opening is cheap regardless of the file size and
+// any part of the file can be read directly. The platform code lives in its
+// own translation unit to keep system headers out of the module.
+class NativeMappedFile
+{
+private:
+    const uint8_t* m_data = nullptr;
+    size_t m_size = 0;
+    void* m_handle = nullptr;           // platform file and mapping handles
+
+public:
+    NativeMappedFile() = default;
+    NativeMappedFile(const NativeMappedFile&) = delete;
+    NativeMappedFile& operator=(const NativeMappedFile&) = delete;
+
+    ~NativeMappedFile()
+    {
+        close();
+    }
+
+    // Maps the file at a UTF-8 path; false if it cannot be opened or mapped
+    bool open(const char* path);
+    void close();
+
+    bool isOpen() const
+    {
+        return m_data != nullptr;
+    }
+
+    const uint8_t* data() const
+    {
+        return m_data;
+    }
+
+    size_t size() const
+    {
+        return m_size;
+    }
+};
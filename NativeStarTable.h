@@ -0,0 +1,307 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "NativeMappedFile.h"
+
+// Star measurements of a whole sequence as a dense frames x stars table. Each
+// frame is one block holding a contiguous float row per field, so that the
+// same field of every star of a frame is a plain array; stars keep their
+// reference frame index as their column. Rows are padded to a multiple of
+// eight entries with zeros. One bit per entry marks the stars measured in a
+// frame; entries of lost stars keep the position where the star is expected.
+// Frames are only appended at the end of the block sequence, so the storage
+// can be written out or mapped as it is.
+//
+// The binary file has a header, a table of byte offsets of the frame blocks
+// (zero for frames never stored) and the blocks themselves, each being the
+// NumFields rows of the frame followed by its validity words, in native byte
+// order. A mapped table reads frames straight from the file and is read-only.
+class NativeStarTable
+{
+public:
+    enum Field
+    {
+        X,
+        Y,
+        Background,
+        Peak,
+        SizeX,
+        SizeY,
+        Fwhm,
+        Ellipticity,
+        Angle,
+        Flux,
+        NumFields
+    };
+
+    static constexpr int Lanes = 8;     // row padding and reduction width
+    static constexpr uint32_t FileVersion = 1;
+
+    struct FileHeader
+    {
+        char magic[8];                  // "LISTARS" and a zero
+        uint32_t version;
+        uint32_t numFields;
+        uint32_t numFrames;
+        uint32_t numStars;
+        uint32_t stride;
+        uint32_t blockBytes;            // bytes per frame block
+        uint64_t frameOffsets;          // byte offset of the frame offset table
+    };
+
+private:
+    int m_numFrames = 0;
+    int m_numStars = 0;
+    int m_stride = 0;                   // padded row length
+    int m_words = 0;                    // validity words per frame
+    std::vector<float> m_data;          // frame blocks of NumFields rows
+    std::vector<uint64_t> m_valid;      // m_words per frame
+    std::vector<uint8_t> m_stored;      // frames written so far
+    NativeMappedFile m_file;            // open when the table is mapped
+    const uint64_t* m_offsets = nullptr;
+
+    size_t blockSize() const
+    {
+        return size_t(NumFields) * m_stride;
+    }
+
+    size_t blockBytes() const
+    {
+        return blockSize() * sizeof(float) + size_t(m_words) * sizeof(uint64_t);
+    }
+
+    bool isMapped() const
+    {
+        return m_file.isOpen();
+    }
+
+    const float* block(int frame) const
+    {
+        if (isMapped())
+            return reinterpret_cast<const float*>(m_file.data() + m_offsets[frame]);
+        return m_data.data() + size_t(frame) * blockSize();
+    }
+
+    const uint64_t* validWords(int frame) const
+    {
+        if (isMapped())
+            return reinterpret_cast<const uint64_t*>(m_file.data() + m_offsets[frame] + blockSize() * sizeof(float));
+        return m_valid.data() + size_t(frame) * m_words;
+    }
+
+public:
+    // Empties the table and fixes the number of stars of every frame.
+    // numFrames only reserves storage.
+    void reset(int numStars, int numFrames = 0)
+    {
+        m_file.close();
+        m_offsets = nullptr;
+        m_numFrames = 0;
+        m_numStars = numStars;
+        m_stride = (numStars + Lanes - 1) / Lanes * Lanes;
+        m_words = (numStars + 63) / 64;
+        m_data.clear();
+        m_valid.clear();
+        m_stored.clear();
+        m_data.reserve(size_t(numFrames) * blockSize());
+        m_valid.reserve(size_t(numFrames) * m_words);
+        m_stored.reserve(numFrames);
+    }
+
+    void clear()
+    {
+        reset(0);
+    }
+
+    // Grows the table to numFrames; new frames are zero, invalid and not
+    // stored. Pointers into the table are invalidated. Not for mapped tables.
+    void resize(int numFrames)
+    {
+        if (numFrames <= m_numFrames)
+            return;
+        m_data.resize(size_t(numFrames) * blockSize(), 0.0f);
+        m_valid.resize(size_t(numFrames) * m_words, 0);
+        m_stored.resize(numFrames, 0);
+        m_numFrames = numFrames;
+    }
+
+    int numFrames() const
+    {
+        return m_numFrames;
+    }
+
+    int numStars() const
+    {
+        return m_numStars;
+    }
+
+    int stride() const
+    {
+        return m_stride;
+    }
+
+    bool isEmpty() const
+    {
+        return m_numFrames == 0;
+    }
+
+    // Rows of a mapped table must not be written
+    float* row(int frame, Field field)
+    {
+        return const_cast<float*>(block(frame)) + size_t(field) * m_stride;
+    }
+
+    const float* row(int frame, Field field) const
+    {
+        return block(frame) + size_t(field) * m_stride;
+    }
+
+    bool isStored(int frame) const
+    {
+        if (frame >= m_numFrames)
+            return false;
+        return isMapped() ? (m_offsets[frame] != 0) : (m_stored[frame] != 0);
+    }
+
+    void setStored(int frame)
+    {
+        m_stored[frame] = 1;
+    }
+
+    bool isValid(int frame, int star) const
+    {
+        return (validWords(frame)[star >> 6] >> (star & 63)) & 1;
+    }
+
+    void setValid(int frame, int star, bool valid)
+    {
+        uint64_t& word = m_valid[size_t(frame) * m_words + (star >> 6)];
+        uint64_t bit = uint64_t(1) << (star & 63);
+        word = valid ? (word | bit) : (word & ~bit);
+    }
+
+    int numValid(int frame) const
+    {
+        const uint64_t* v = validWords(frame);
+        int n = 0;
+        for (int i = 0; i < m_words; i++)
+            for (uint64_t word = v[i]; word != 0; word &= word - 1)
+                n++;
+        return n;
+    }
+
+    // Expands the validity bits of a frame to 1/0 weights, stride() entries
+    void weights(int frame, float* w) const
+    {
+        const uint64_t* v = validWords(frame);
+        for (int i = 0; i < m_stride; i++)
+            w[i] = (i < m_numStars) ? float((v[i >> 6] >> (i & 63)) & 1) : 0.0f;
+    }
+
+    // Weighted sum of one field of a frame
+    float sum(int frame, Field field, const float* w) const
+    {
+        const float* a = row(frame, field);
+        float acc[Lanes] = {};
+        for (int i = 0; i < m_stride; i += Lanes)
+            for (int k = 0; k < Lanes; k++)
+                acc[k] += w[i + k] * a[i + k];
+        return reduce(acc);
+    }
+
+    // Weighted sum of the change of one field between two frames
+    float sumDifference(int frame, int from, Field field, const float* w) const
+    {
+        const float* a = row(frame, field);
+        const float* b = row(from, field);
+        float acc[Lanes] = {};
+        for (int i = 0; i < m_stride; i += Lanes)
+            for (int k = 0; k < Lanes; k++)
+                acc[k] += w[i + k] * (a[i + k] - b[i + k]);
+        return reduce(acc);
+    }
+
+    // Writes the table in the binary file layout through a function
+    // write(const void* data, size_t size)
+    template<class W>
+    void write(W&& write) const
+    {
+        FileHeader header = {};
+        std::memcpy(header.magic, "LISTARS", 8);
+        header.version = FileVersion;
+        header.numFields = NumFields;
+        header.numFrames = uint32_t(m_numFrames);
+        header.numStars = uint32_t(m_numStars);
+        header.stride = uint32_t(m_stride);
+        header.blockBytes = uint32_t(blockBytes());
+        header.frameOffsets = sizeof(FileHeader);
+        write(&header, sizeof(FileHeader));
+
+        // Blocks start on a cache line boundary after the offset table
+        size_t tableEnd = sizeof(FileHeader) + size_t(m_numFrames) * sizeof(uint64_t);
+        size_t offset = (tableEnd + 63) / 64 * 64;
+        std::vector<uint64_t> offsets(m_numFrames, 0);
+        for (int i = 0; i < m_numFrames; i++)
+            if (isStored(i))
+            {
+                offsets[i] = offset;
+                offset += blockBytes();
+            }
+        write(offsets.data(), offsets.size() * sizeof(uint64_t));
+        static const uint8_t padding[64] = {};
+        write(padding, (tableEnd + 63) / 64 * 64 - tableEnd);
+        for (int i = 0; i < m_numFrames; i++)
+            if (isStored(i))
+            {
+                write(block(i), blockSize() * sizeof(float));
+                write(validWords(i), size_t(m_words) * sizeof(uint64_t));
+            }
+    }
+
+    // Maps a file written by write(). False if the file cannot be mapped or
+    // is not a consistent star table, leaving the table empty.
+    bool map(const char* path)
+    {
+        reset(0);
+        if (!m_file.open(path))
+            return false;
+        FileHeader header;
+        bool ok = m_file.size() >= sizeof(FileHeader);
+        if (ok)
+        {
+            std::memcpy(&header, m_file.data(), sizeof(FileHeader));
+            m_numStars = int(header.numStars);
+            m_stride = (m_numStars + Lanes - 1) / Lanes * Lanes;
+            m_words = (m_numStars + 63) / 64;
+            ok = (std::memcmp(header.magic, "LISTARS", 8) == 0) && (header.version == FileVersion)
+                && (header.numFields == NumFields) && (header.numStars < (1u << 30)) && (header.stride == uint32_t(m_stride))
+                && (header.blockBytes == blockBytes()) && (header.frameOffsets % sizeof(uint64_t) == 0)
+                && (header.frameOffsets <= m_file.size())
+                && (uint64_t(header.numFrames) * sizeof(uint64_t) <= m_file.size() - header.frameOffsets)
+                && (blockBytes() <= m_file.size());
+        }
+        if (ok)
+        {
+            m_offsets = reinterpret_cast<const uint64_t*>(m_file.data() + header.frameOffsets);
+            for (uint32_t i = 0; ok && (i < header.numFrames); i++)
+                ok = (m_offsets[i] == 0) || ((m_offsets[i] % sizeof(uint64_t) == 0) && (m_offsets[i] <= m_file.size() - blockBytes()));
+        }
+        if (!ok)
+        {
+            reset(0);
+            return false;
+        }
+        m_numFrames = int(header.numFrames);
+        return true;
+    }
+
+private:
+    static float reduce(const float* acc)
+    {
+        return ((acc[0] + acc[4]) + (acc[1] + acc[5])) + ((acc[2] + acc[6]) + (acc[3] + acc[7]));
+    }
+};